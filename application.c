@@ -9,7 +9,9 @@
 #include "display.h"
 #include "http.h"
 #include "io.h"
+#include "notify.h"
 #include "io_gpio.h"
+#include "io_aux.h"
 #include "time.h"
 #include "ota.h"
 
@@ -36,6 +38,7 @@ irom app_action_t application_content(const string_t *src, string_t *dst)
 
 	const application_function_table_t *tableptr;
 	int status_io, status_pin;
+	app_action_t action;
 
 	if(config_get_int(&varname_io, -1, -1, &status_io) &&
 			config_get_int(&varname_pin, -1, -1, &status_pin) &&
@@ -55,7 +58,12 @@ irom app_action_t application_content(const string_t *src, string_t *dst)
 	if(tableptr->function)
 	{
 		string_clear(dst);
-		return(tableptr->function(src, dst));
+		action = tableptr->function(src, dst);
+
+		if(io_flush(dst) != io_ok)
+			action = app_action_error;
+
+		return(action);
 	}
 
 	string_append(dst, ": command unknown\n");
@@ -258,6 +266,12 @@ irom static app_action_t application_function_stats_i2c(const string_t *src, str
 	return(app_action_normal);
 }
 
+irom static app_action_t application_function_stats_pwm(const string_t *src, string_t *dst)
+{
+	stats_pwm(dst);
+	return(app_action_normal);
+}
+
 irom static app_action_t application_function_stats_wlan(const string_t *src, string_t *dst)
 {
 	stats_wlan(dst);
@@ -326,6 +340,95 @@ irom static app_action_t application_function_bridge_timeout(const string_t *src
 	return(app_action_normal);
 }
 
+irom static app_action_t application_function_bridge_framing(const string_t *src, string_t *dst)
+{
+	uart_framing_t framing;
+	int framing_int, delimiter, gap;
+	string_init(varname_bridge_framing, "bridge.framing");
+	string_init(varname_bridge_delimiter, "bridge.delimiter");
+	string_init(varname_bridge_gap, "bridge.gap");
+
+	if(parse_string(1, src, dst, ' ') == parse_ok)
+	{
+		framing = uart_string_to_framing(dst);
+
+		if((framing < uart_framing_none) || (framing >= uart_framing_error))
+		{
+			string_append(dst, ": invalid framing\n");
+			return(app_action_error);
+		}
+
+		string_clear(dst);
+
+		if(framing == uart_framing_none)
+			config_delete(&varname_bridge_framing, -1, -1, false);
+		else
+		{
+			framing_int = (int)framing;
+
+			if(!config_set_int(&varname_bridge_framing, -1, -1, framing_int))
+			{
+				string_append(dst, "> cannot set config\n");
+				return(app_action_error);
+			}
+		}
+
+		if((framing == uart_framing_delimiter) && (parse_int(2, src, &delimiter, 0, ' ') == parse_ok))
+		{
+			if((delimiter < 0) || (delimiter > 255))
+			{
+				string_format(dst, "> invalid delimiter: %d\n", delimiter);
+				return(app_action_error);
+			}
+
+			if(delimiter == '\n')
+				config_delete(&varname_bridge_delimiter, -1, -1, false);
+			else
+				if(!config_set_int(&varname_bridge_delimiter, -1, -1, delimiter))
+				{
+					string_append(dst, "> cannot set config\n");
+					return(app_action_error);
+				}
+		}
+
+		if(((framing == uart_framing_gap) || (framing == uart_framing_modbus)) && (parse_int(2, src, &gap, 0, ' ') == parse_ok))
+		{
+			if((gap < 1) || (gap > 127))
+			{
+				string_format(dst, "> invalid gap: %d\n", gap);
+				return(app_action_error);
+			}
+
+			if(gap == 4)
+				config_delete(&varname_bridge_gap, -1, -1, false);
+			else
+				if(!config_set_int(&varname_bridge_gap, -1, -1, gap))
+				{
+					string_append(dst, "> cannot set config\n");
+					return(app_action_error);
+				}
+		}
+	}
+
+	if(config_get_int(&varname_bridge_framing, -1, -1, &framing_int))
+		framing = (uart_framing_t)framing_int;
+	else
+		framing = uart_framing_none;
+
+	if(!config_get_int(&varname_bridge_delimiter, -1, -1, &delimiter))
+		delimiter = '\n';
+
+	if(!config_get_int(&varname_bridge_gap, -1, -1, &gap))
+		gap = 4;
+
+	string_clear(dst);
+	string_append(dst, "> framing: ");
+	uart_framing_to_string(dst, framing);
+	string_format(dst, ", delimiter: 0x%02x, gap: %d characters\n", delimiter, gap);
+
+	return(app_action_normal);
+}
+
 irom static app_action_t application_function_command_port(const string_t *src, string_t *dst)
 {
 	string_init(varname_cmdport, "cmd.port");
@@ -1361,6 +1464,11 @@ static const application_function_table_t application_function_table[] =
 		application_function_bridge_timeout,
 		"set uart bridge tcp connection timeout (default 0)"
 	},
+	{
+		"bf", "bridge-framing",
+		application_function_bridge_framing,
+		"set uart bridge framing [none/slip/cobs/delimiter <byte>/gap <characters>/modbus <characters>]"
+	},
 	{
 		"cp", "command-port",
 		application_function_command_port,
@@ -1486,6 +1594,46 @@ static const application_function_table_t application_function_table[] =
 		application_function_io_write,
 		"write to i/o pin",
 	},
+	{
+		"iwm", "io-write-mask",
+		application_function_io_write_mask,
+		"write to multiple i/o pins at once",
+	},
+	{
+		"ira", "io-read-all",
+		application_function_io_read_all,
+		"read all enabled i/o pins",
+	},
+	{
+		"irb", "io-read-binary",
+		application_function_io_read_binary,
+		"read all enabled i/o pins, binary reply",
+	},
+	{
+		"ac", "adc-capture",
+		application_function_adc_capture,
+		"capture adc samples at fixed interval, show status",
+	},
+	{
+		"acr", "adc-capture-read",
+		application_function_adc_capture_read,
+		"read captured adc samples, binary reply",
+	},
+	{
+		"if", "io-fade",
+		application_function_io_fade,
+		"fade analog output to value along a curve",
+	},
+	{
+		"ij", "io-journal",
+		application_function_io_journal,
+		"show pin change events since <cursor>",
+	},
+	{
+		"nsu", "notify-subscribe",
+		application_function_notify_subscribe,
+		"subscribe to pin change notifications",
+	},
 	{
 		"isf", "io-set-flag",
 		application_function_io_set_flag,
@@ -1494,7 +1642,7 @@ static const application_function_table_t application_function_table[] =
 	{
 		"pp", "pwm-period",
 		application_function_pwm_period,
-		"set pwm period (rate = 200 ns / period)",
+		"set pwm period (rate = 200 ns / period), min phase gap, dither bits and stagger, channels less than min gap (at most period / 64) apart share an edge, the later one ends up to min gap ticks early",
 	},
 	{
 		"icf", "io-clear-flag",
@@ -1616,6 +1764,11 @@ static const application_function_table_t application_function_table[] =
 		application_function_stats_i2c,
 		"stats (i2c)",
 	},
+	{
+		"sp", "stats-pwm",
+		application_function_stats_pwm,
+		"stats (pwm)",
+	},
 	{
 		"st", "stats-time",
 		application_function_stats_time,
@@ -52,13 +52,22 @@ iram static bool send_byte_raw(int byte, bool data)
 	if(!set_pin(io_lcd_d7, !!(byte & (1 << 7))))
 		return(false);
 
+	// pins on i/o expanders may be written deferred, make sure
+	// the data is stable before the enable line is toggled
+
+	if(io_flush((string_t *)0) != io_ok)
+		return(false);
+
 	if(!set_pin(io_lcd_e, false))
 		return(false);
 
+	if(io_flush((string_t *)0) != io_ok)
+		return(false);
+
 	if(!set_pin(io_lcd_e, true))
 		return(false);
 
-	return(true);
+	return(io_flush((string_t *)0) == io_ok);
 }
 
 iram static bool send_byte(int byte, bool data)
@@ -218,7 +227,7 @@ irom bool_t display_lcd_bright(int brightness)
 
 	set_pin(io_lcd_bl, pwm); // backlight pin might be not configured, ignore error
 
-	return(true);
+	return(io_flush((string_t *)0) == io_ok);
 }
 
 irom bool_t display_lcd_set(const char *tag, const char *text)
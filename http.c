@@ -299,6 +299,9 @@ irom static app_action_t handler_set(const string_t *src, string_t *dst)
 
 	error = io_write_pin(dst, io, pin, value);
 
+	if(error == io_ok)
+		error = io_flush(dst);
+
 	if(error == io_ok)
 		string_append(dst, "<script>location.replace(\"/controls\");</script>\n");
 	else
@@ -1,6 +1,7 @@
 #include "i2c.h"
 
 #include "util.h"
+#include "stats.h"
 
 #include <user_interface.h>
 
@@ -19,6 +20,17 @@ _Static_assert(sizeof(i2c_direction_t) == 4, "sizeof(i2c_direction_t) != 4");
 typedef enum
 {
 	i2c_config_stretch_clock_timeout = 20000,
+	i2c_config_queue_size = 8,
+	i2c_config_merge_max = 4,
+	i2c_config_devices = 128,
+	i2c_config_speed_default_khz = 100,
+	i2c_config_speed_high_khz = 400,
+	i2c_config_speed_min_khz = 10,
+	i2c_config_speed_max_khz = 200,			// one timer nmi per half clock period, ~2.5 us per nmi is what the interrupt path sustains
+	i2c_config_timer_ticks_per_us = 5,			// timer ticks are 200 ns
+	i2c_config_calibrate_loops = 64,
+	i2c_config_calibrate_rounds = 4,
+	i2c_config_wait_timeout_us = 500000,		// a full queue of long transfers at the lowest speed takes less
 } i2c_config_t;
 
 struct
@@ -68,14 +80,81 @@ static roflash const char roflash_error_strings[i2c_error_size][32] =
 	"device specific error 4",
 	"device specific error 5",
 	"invalid bus",
+	"queue full",
+	"timeout",
 };
 
 static int sda_pin;
 static int scl_pin;
 static int i2c_bus_speed_delay;
-static i2c_state_t state = i2c_state_invalid;
+static volatile i2c_state_t state = i2c_state_invalid;
 static i2c_state_t error_state = i2c_state_invalid;
 
+// the slots are filled by i2c_queue (task), started and completed by the
+// engine (timer interrupt) and retired by i2c_periodic (task), every
+// status transition has only one writer
+
+typedef enum
+{
+	i2c_slot_free = 0,
+	i2c_slot_pending,
+	i2c_slot_active,
+	i2c_slot_done,
+} i2c_slot_status_t;
+
+typedef struct
+{
+	i2c_transaction_t			transaction;
+	volatile i2c_slot_status_t	status;
+	uint32_t					sequence;
+	uint32_t					queued;		// ccount
+} i2c_slot_t;
+
+typedef struct attr_packed
+{
+	unsigned int priority:2;
+	unsigned int sequential:1;		// register address auto-increments
+} i2c_device_t;
+
+assert_size(i2c_device_t, 1);
+
+static i2c_slot_t i2c_slot[i2c_config_queue_size];
+static uint32_t i2c_slot_sequence = 0;
+static i2c_device_t i2c_device[i2c_config_devices];
+static volatile int i2c_mux_bus = -1;		// -1 = unknown
+static unsigned int i2c_bus_selected = 0;
+
+static struct
+{
+	i2c_transaction_t	*transaction;
+	int					receive_length;		// of all merged transactions
+	int					slot[i2c_config_merge_max];
+	unsigned int		slots;				// 0 = multiplexer select or release inserted by the engine
+	unsigned int		slot_index;
+	int					slot_offset;
+	int					held_address;		// of the transaction that kept the bus
+	int					held_bus;
+	int					select_for;			// -1 = release
+	int					select_bus;
+	uint8_t				select_byte;
+	i2c_transaction_t	select;
+	unsigned int		half_period;	// timer ticks
+	unsigned int		speed;			// kHz
+	unsigned int		requested_speed;	// kHz
+	unsigned int		limited:1;		// by the timer interrupt rate
+	uint32_t			started;		// ccount
+	uint32_t			first_clock;	// ccount
+	uint32_t			last_clock;		// ccount
+	unsigned int		clocks;
+	unsigned int		stretch;
+	i2c_direction_t		direction;
+	int					sent;
+	int					received;
+	unsigned int		bits;
+	uint8_t				byte;
+	unsigned int		raise_clock:1;
+} i2c_engine;
+
 irom void i2c_error_format_string(string_t *dst, i2c_error_t error)
 {
 	if(error != i2c_error_ok)
@@ -146,73 +225,6 @@ iram static inline bool_t scl_is_high(void)
 	return(gpio_get(scl_pin));
 }
 
-iram static inline i2c_error_t wait_for_scl(void)
-{
-	int current;
-
-	for(current = i2c_config_stretch_clock_timeout; current > 0; current--)
-	{
-		if(scl_is_high())
-			break;
-
-		microdelay();
-	}
-
-	if(current == 0)
-		return(i2c_error_bus_lock);
-
-	return(i2c_error_ok);
-}
-
-iram static noinline i2c_error_t send_start(void)
-{
-	state = i2c_state_start_send;
-
-	microdelay();
-	microdelay();
-
-	if(scl_is_low())
-	{
-		scl_high();
-		microdelay();
-		microdelay();
-	}
-
-	if(scl_is_low())
-		return(i2c_error_bus_lock);
-
-	if(sda_is_low())
-	{
-		scl_low();
-		microdelay();
-		microdelay();
-		sda_high();
-		microdelay();
-		microdelay();
-		scl_high();
-		microdelay();
-		microdelay();
-	}
-
-	if(sda_is_low())
-		return(i2c_error_sda_stuck);
-
-	// start condition
-
-	sda_low();
-
-	microdelay();
-	microdelay();
-
-	if(scl_is_low())
-		return(i2c_error_bus_lock);
-
-	if(sda_is_high())
-		return(i2c_error_sda_stuck);
-
-	return(i2c_error_ok);
-}
-
 iram static noinline i2c_error_t send_stop(void)
 {
 	state = i2c_state_stop_send;
@@ -257,9 +269,13 @@ irom static void i2c_reset(void)
 	if(!i2c_flags.init_done)
 		return;
 
-	if(state != i2c_state_idle)
+	if((state != i2c_state_idle) && (state != i2c_state_error))
 		error_state = state;
 
+	// the multiplexer may or may not have seen the last select
+
+	i2c_mux_bus = -1;
+
 	for(try = 16; try > 0; try--)
 	{
 		for(delaycounter = 8; delaycounter > 0; delaycounter--)
@@ -272,306 +288,857 @@ irom static void i2c_reset(void)
 	state = i2c_state_idle;
 }
 
-iram static noinline i2c_error_t send_bit(bool_t bit)
+// asynchronous engine, advanced from the frc1 timer interrupt, one step
+// per half clock period, the clock is driven low and sda set in one
+// step, the clock is released in the next, the step after that checks
+// the clock is really high (clock stretching) and samples sda
+
+always_inline static bool_t i2c_on_bus(const i2c_transaction_t *transaction)
 {
-	i2c_error_t error;
+	return(!i2c_flags.multiplexer || (transaction->bus < 0) || (transaction->bus == i2c_mux_bus));
+}
 
-	// at this point scl should be off and sda will be unknown
-	// wait for scl to be released by slave (clock stretching)
+always_inline static bool_t i2c_register_read(const i2c_transaction_t *transaction)
+{
+	return((transaction->reg >= 0) && (transaction->send_length == 0) && (transaction->receive_length > 0) && transaction->stop);
+}
 
-	if((error = wait_for_scl()) != i2c_error_ok)
-		return(error);
+always_inline static bool_t i2c_mux_select(const i2c_transaction_t *transaction)
+{
+	return((transaction->address == 0x70) && (transaction->reg < 0) && (transaction->send_length == 1) && (transaction->receive_length == 0));
+}
 
-	scl_low();
-	microdelay();
+always_inline static int i2c_mux_bus_from_byte(unsigned int byte)
+{
+	int bus;
 
-	if(bit)
-	{
-		sda_high();
+	for(bus = 0; byte; byte >>= 1)
+		bus++;
 
-		microdelay();
+	return(bus);
+}
 
-		if(sda_is_low())
-			return(i2c_error_sda_stuck);
-	}
-	else
+// highest priority first, then the transactions that don't need a
+// multiplexer switch, then the oldest, after a transaction that kept the
+// bus (repeated start) only the oldest one for the same device and bus
+// may follow
+
+iram static int i2c_engine_pick(bool_t held)
+{
+	const i2c_slot_t *slot, *best_slot;
+	int ix, best;
+	bool_t on_bus;
+
+	for(ix = 0, best = -1; ix < i2c_config_queue_size; ix++)
 	{
-		sda_low();
+		slot = &i2c_slot[ix];
 
-		microdelay();
+		if(slot->status != i2c_slot_pending)
+			continue;
 
-		if(sda_is_high())
-			return(i2c_error_sda_stuck);
+		if(held && ((slot->transaction.address != i2c_engine.held_address) || (slot->transaction.bus != i2c_engine.held_bus)))
+			continue;
+
+		if(best < 0)
+		{
+			best = ix;
+			continue;
+		}
+
+		best_slot = &i2c_slot[best];
+
+		if(!held)
+		{
+			if(slot->transaction.priority != best_slot->transaction.priority)
+			{
+				if(slot->transaction.priority > best_slot->transaction.priority)
+					best = ix;
+
+				continue;
+			}
+
+			on_bus = i2c_on_bus(&slot->transaction);
+
+			if(on_bus != i2c_on_bus(&best_slot->transaction))
+			{
+				if(on_bus)
+					best = ix;
+
+				continue;
+			}
+		}
+
+		if((int32_t)(slot->sequence - best_slot->sequence) < 0)
+			best = ix;
 	}
 
-	scl_high();
+	return(best);
+}
 
-	microdelay();
-	microdelay();
+iram static void i2c_engine_claim(int ix)
+{
+	uint32_t wait;
 
-	// take care of clock stretching
+	wait = read_ccount() - i2c_slot[ix].queued;
 
-	if((error = wait_for_scl()) != i2c_error_ok)
-		return(error);
+	stat_i2c_wait_cycles += wait;
 
-	return(i2c_error_ok);
+	if(wait > stat_i2c_wait_max_cycles)
+		stat_i2c_wait_max_cycles = wait;
+
+	i2c_slot[ix].status = i2c_slot_active;
+	i2c_engine.slot[i2c_engine.slots++] = ix;
 }
 
-iram static i2c_error_t send_byte(int byte)
+// take the transaction and append pending reads of the registers directly
+// following it, the received bytes are distributed over their buffers
+
+iram static void i2c_engine_start(int ix)
 {
-	i2c_error_t error;
-	int current;
+	i2c_transaction_t *transaction, *next;
+	int candidate;
 
-	if((state != i2c_state_address_send) && (state != i2c_state_data_send_data))
-		return(i2c_error_invalid_state_not_send_address_or_data);
+	transaction = &i2c_slot[ix].transaction;
 
-	for(current = 8; current > 0; current--)
+	i2c_engine.transaction = transaction;
+	i2c_engine.receive_length = transaction->receive_length;
+	i2c_engine.slots = 0;
+	i2c_engine.slot_index = 0;
+	i2c_engine.slot_offset = 0;
+
+	i2c_engine_claim(ix);
+
+	if(!i2c_device[transaction->address & 0x7f].sequential || !i2c_register_read(transaction))
+		return;
+
+	while(i2c_engine.slots < i2c_config_merge_max)
 	{
-		if((error = send_bit(byte & 0x80)) != i2c_error_ok)
-			return(error);
-		byte <<= 1;
+		for(candidate = 0; candidate < i2c_config_queue_size; candidate++)
+		{
+			next = &i2c_slot[candidate].transaction;
+
+			if((i2c_slot[candidate].status == i2c_slot_pending) && i2c_register_read(next) &&
+					(next->address == transaction->address) && (next->bus == transaction->bus) &&
+					(next->reg == (transaction->reg + i2c_engine.receive_length)))
+				break;
+		}
+
+		if(candidate >= i2c_config_queue_size)
+			break;
+
+		i2c_engine_claim(candidate);
+		i2c_engine.receive_length += next->receive_length;
+		stat_i2c_merged++;
 	}
+}
 
-	return(i2c_error_ok);
+// switch the multiplexer to the bus the transaction needs first
+
+iram static void i2c_engine_start_select(int ix)
+{
+	i2c_transaction_t *select = &i2c_engine.select;
+
+	i2c_engine.select_for = ix;
+	i2c_engine.select_bus = i2c_slot[ix].transaction.bus;
+	i2c_engine.select_byte = (1 << i2c_engine.select_bus) >> 1;
+
+	select->address = 0x70;
+	select->reg = -1;
+	select->send_length = 1;
+	select->send = &i2c_engine.select_byte;
+	select->receive_length = 0;
+	select->receive = (uint8_t *)0;
+	select->stop = true;
+
+	i2c_engine.transaction = select;
+	i2c_engine.receive_length = 0;
+	i2c_engine.slots = 0;
 }
 
-iram static noinline i2c_error_t receive_bit(bool_t *bit)
+iram static void i2c_engine_store(uint8_t byte)
 {
-	i2c_error_t error;
+	i2c_transaction_t *transaction;
+	int offset;
 
-	// at this point scl should be high and sda is unknown,
-	// but should be high before reading
+	transaction = &i2c_slot[i2c_engine.slot[i2c_engine.slot_index]].transaction;
+	offset = i2c_engine.received++ - i2c_engine.slot_offset;
 
-	if(state == i2c_state_idle)
-		return(i2c_error_invalid_state_idle);
+	transaction->receive[offset] = byte;
 
-	// wait for scl to be released by slave (clock stretching)
+	if((offset + 1) >= transaction->receive_length)
+	{
+		i2c_engine.slot_offset = i2c_engine.received;
+		i2c_engine.slot_index++;
+	}
+}
 
-	if((error = wait_for_scl()) != i2c_error_ok)
-		return(error);
+iram static unsigned int i2c_engine_done(i2c_error_t error)
+{
+	i2c_transaction_t *transaction;
+	unsigned int ix;
+
+	if((i2c_engine.slots == 0) && (i2c_engine.select_for >= 0))
+	{
+		// a failed multiplexer select also fails the transaction it was for
 
-	// make sure sda is off so slave can pull it
-	// do it while clock is pulled
+		stat_i2c_select_writes++;
 
-	scl_low();
-	microdelay();
-	sda_high();
-	microdelay();
-	scl_high();
-	microdelay();
-	microdelay();
+		if(error == i2c_error_ok)
+			i2c_mux_bus = i2c_engine.select_bus;
+		else
+		{
+			i2c_slot[i2c_engine.select_for].transaction.error = error;
+			i2c_slot[i2c_engine.select_for].status = i2c_slot_done;
+		}
+	}
 
-	// take care of clock stretching
+	for(ix = 0; ix < i2c_engine.slots; ix++)
+	{
+		transaction = &i2c_slot[i2c_engine.slot[ix]].transaction;
+		transaction->error = error;
 
-	if((error = wait_for_scl()) != i2c_error_ok)
-		return(error);
+		if((error == i2c_error_ok) && i2c_mux_select(transaction))
+			i2c_mux_bus = i2c_mux_bus_from_byte(transaction->send[0]);
 
-	*bit = sda_is_high() ? 1 : 0;
+		i2c_slot[i2c_engine.slot[ix]].status = i2c_slot_done;
+	}
 
-	return(i2c_error_ok);
+	// measure the real clock rate, including timer interrupt latency, from
+	// the first to the last rising clock edge of the transaction
+
+	stat_i2c_busy_cycles += read_ccount() - i2c_engine.started;
+
+	if(i2c_engine.clocks > 1)
+	{
+		stat_i2c_clock_cycles += i2c_engine.last_clock - i2c_engine.first_clock;
+		stat_i2c_clock_periods += i2c_engine.clocks - 1;
+	}
+
+	return(i2c_engine.half_period);
+}
+
+iram static unsigned int i2c_engine_fail(i2c_error_t error)
+{
+	error_state = state;
+	state = i2c_state_error;
+	i2c_mux_bus = -1;
+
+	i2c_engine_done(error);
+
+	// the bus is reset from i2c_periodic, which restarts the engine
+
+	return(0);
 }
 
-iram static noinline i2c_error_t receive_byte(uint8_t *byte)
+iram static unsigned int i2c_engine_clock(bool_t sda)
+{
+	scl_low();
+
+	if(sda)
+		sda_high();
+	else
+		sda_low();
+
+	i2c_engine.raise_clock = 1;
+
+	return(i2c_engine.half_period);
+}
+
+iram static unsigned int i2c_engine_send_bit(void)
 {
-	int current;
 	bool_t bit;
-	i2c_error_t error;
 
-	for(*byte = 0, current = 8; current > 0; current--)
+	if(i2c_engine.bits == 0)
 	{
-		*byte <<= 1;
+		// release sda for the ack from the slave
 
-		if((error = receive_bit(&bit)) != i2c_error_ok)
-			return(error);
+		if(state == i2c_state_address_send)
+			state = i2c_state_address_ack_receive;
+		else
+			state = i2c_state_data_send_ack_receive;
 
-		if(bit)
-			*byte |= 0x01;
+		return(i2c_engine_clock(true));
 	}
 
-	return(i2c_error_ok);
+	i2c_engine.bits--;
+	bit = !!(i2c_engine.byte & 0x80);
+	i2c_engine.byte <<= 1;
+
+	return(i2c_engine_clock(bit));
 }
 
-iram static noinline i2c_error_t send_ack(bool_t ack)
+iram static unsigned int i2c_engine_receive_byte(void)
 {
-	i2c_error_t error;
-
-	if(state != i2c_state_data_receive_ack_send)
-		return(i2c_error_invalid_state_not_send_ack);
-
-	if((error = send_bit(!ack)) != i2c_error_ok)
-		return(error);
+	state = i2c_state_data_receive_data;
+	i2c_engine.bits = 8;
+	i2c_engine.byte = 0;
 
-	return(i2c_error_ok);
+	return(i2c_engine_clock(true));
 }
 
-iram static noinline i2c_error_t receive_ack(bool_t *ack)
+iram static unsigned int i2c_engine_stop(void)
 {
-	i2c_error_t error;
-	bool_t bit;
+	state = i2c_state_stop_send;
 
-	if((state != i2c_state_address_ack_receive) && (state != i2c_state_data_send_ack_receive))
-		return(i2c_error_invalid_state_not_receive_ack);
+	return(i2c_engine_clock(false));
+}
 
-	if((error = receive_bit(&bit)) != i2c_error_ok)
-		return(error);
+// end a transaction that kept the bus with a stop condition, when nothing
+// for the same device follows but other transactions are waiting
 
-	*ack = !bit;
+iram static unsigned int i2c_engine_release(void)
+{
+	i2c_engine.receive_length = 0;
+	i2c_engine.slots = 0;
+	i2c_engine.select_for = -1;
+	i2c_engine.started = read_ccount();
+	i2c_engine.clocks = 0;
 
-	return(i2c_error_ok);
+	return(i2c_engine_stop());
 }
 
-iram static noinline i2c_error_t send_header(int address, i2c_direction_t direction)
+// after the address or a data byte has been acked, in send direction
+
+iram static unsigned int i2c_engine_next(void)
 {
-	i2c_error_t error;
-	bool_t ack;
+	i2c_transaction_t *transaction = i2c_engine.transaction;
+	int send_length;
 
-	if(state != i2c_state_header_send)
-		return(i2c_error_invalid_state_not_send_header);
+	if(i2c_engine.direction == i2c_direction_receive)
+	{
+		if(i2c_engine.received < i2c_engine.receive_length)
+			return(i2c_engine_receive_byte());
 
-	address <<= 1;
-	address |= direction == i2c_direction_receive ? 0x01 : 0x00;
+		return(i2c_engine_stop());
+	}
 
-	if((error = send_start()) != i2c_error_ok)
-		return(error);
+	send_length = transaction->send_length + ((transaction->reg >= 0) ? 1 : 0);
 
-	state = i2c_state_address_send;
+	if(i2c_engine.sent < send_length)
+	{
+		if(transaction->reg >= 0)
+			i2c_engine.byte = (i2c_engine.sent == 0) ? transaction->reg : transaction->send[i2c_engine.sent - 1];
+		else
+			i2c_engine.byte = transaction->send[i2c_engine.sent];
 
-	if((error = send_byte(address)) != i2c_error_ok)
-		return(error);
+		i2c_engine.sent++;
+		i2c_engine.bits = 8;
+		state = i2c_state_data_send_data;
 
-	state = i2c_state_address_ack_receive;
+		return(i2c_engine_send_bit());
+	}
 
-	if((error = receive_ack(&ack)) != i2c_error_ok)
-		return(error);
+	if(i2c_engine.receive_length > 0)
+	{
+		// repeated start, release sda while the clock is low
+
+		i2c_engine.direction = i2c_direction_receive;
+		state = i2c_state_header_send;
 
-	state = i2c_state_address_ack_received;
+		return(i2c_engine_clock(true));
+	}
 
-	if(!ack)
-		return(i2c_error_address_nak);
+	if(!transaction->stop)
+	{
+		// keep the bus, the next transaction starts with a repeated start
 
-	return(i2c_error_ok);
+		state = i2c_state_data_send_ack_received;
+		i2c_engine.held_address = transaction->address;
+		i2c_engine.held_bus = transaction->bus;
+
+		return(i2c_engine_done(i2c_error_ok));
+	}
+
+	return(i2c_engine_stop());
 }
 
-irom void i2c_init(int sda_in, int scl_in)
+iram static unsigned int i2c_engine_step(void)
 {
-	uint8_t byte;
+	const i2c_transaction_t *transaction;
+	uint32_t now;
+	int ix;
 
-	sda_pin = sda_in;
-	scl_pin = scl_in;
+	if(i2c_engine.raise_clock)
+	{
+		i2c_engine.raise_clock = 0;
+		i2c_engine.stretch = 0;
+		scl_high();
 
-	i2c_flags.init_done = 1;
+		now = read_ccount();
 
-	if(config_flags_get().flag.i2c_high_speed)
-		i2c_bus_speed_delay = 2;
-	else
-	{
-		if(config_flags_get().flag.cpu_high_speed)
-			i2c_bus_speed_delay = 66;
-		else
-			i2c_bus_speed_delay = 24;
+		if(i2c_engine.clocks++ == 0)
+			i2c_engine.first_clock = now;
+
+		i2c_engine.last_clock = now;
+
+		return(i2c_engine.half_period);
 	}
 
-	i2c_reset();
+	// the clock should be high now, unless the slave stretches it
 
-	if(i2c_receive(0x70, 1, &byte) == i2c_error_ok)
+	if((state != i2c_state_idle) && scl_is_low())
 	{
-		i2c_flags.multiplexer = 1;
-		i2c_select_bus(0);
+		if(++i2c_engine.stretch < i2c_config_stretch_clock_timeout)
+			return(i2c_engine.half_period);
+
+		return(i2c_engine_fail(i2c_error_bus_lock));
+	}
+
+	switch(state)
+	{
+		case(i2c_state_idle):
+		case(i2c_state_data_send_ack_received):
+		{
+			if((ix = i2c_engine_pick(state == i2c_state_data_send_ack_received)) < 0)
+			{
+				if((state == i2c_state_data_send_ack_received) && (i2c_engine_pick(false) >= 0))
+					return(i2c_engine_release());
+
+				return(0);
+			}
+
+			if((state == i2c_state_idle) && !i2c_on_bus(&i2c_slot[ix].transaction))
+				i2c_engine_start_select(ix);
+			else
+				i2c_engine_start(ix);
+
+			transaction = i2c_engine.transaction;
+
+			i2c_engine.started = read_ccount();
+			i2c_engine.clocks = 0;
+			i2c_engine.sent = 0;
+			i2c_engine.received = 0;
+
+			if(((transaction->reg < 0) && (transaction->send_length == 0)) && (transaction->receive_length > 0))
+				i2c_engine.direction = i2c_direction_receive;
+			else
+				i2c_engine.direction = i2c_direction_send;
+
+			if(state == i2c_state_data_send_ack_received)
+			{
+				// bus kept by the previous transaction, repeated start
+
+				state = i2c_state_header_send;
+
+				return(i2c_engine_clock(true));
+			}
+
+			stat_i2c_transactions++;
+			state = i2c_state_header_send;
+
+			// fall through
+		}
+
+		case(i2c_state_header_send):
+		{
+			if(sda_is_low())
+				return(i2c_engine_fail(i2c_error_sda_stuck));
+
+			// start condition
+
+			state = i2c_state_start_send;
+			sda_low();
+
+			return(i2c_engine.half_period);
+		}
+
+		case(i2c_state_start_send):
+		{
+			state = i2c_state_address_send;
+			i2c_engine.byte = (i2c_engine.transaction->address << 1) | ((i2c_engine.direction == i2c_direction_receive) ? 0x01 : 0x00);
+			i2c_engine.bits = 8;
+
+			return(i2c_engine_send_bit());
+		}
+
+		case(i2c_state_address_send):
+		case(i2c_state_data_send_data):
+		{
+			return(i2c_engine_send_bit());
+		}
+
+		case(i2c_state_address_ack_receive):
+		{
+			if(sda_is_high())
+				return(i2c_engine_fail(i2c_error_address_nak));
+
+			state = i2c_state_address_ack_received;
+
+			return(i2c_engine_next());
+		}
+
+		case(i2c_state_data_send_ack_receive):
+		{
+			if(sda_is_high())
+				return(i2c_engine_fail(i2c_error_data_nak));
+
+			state = i2c_state_data_send_ack_received;
+
+			return(i2c_engine_next());
+		}
+
+		case(i2c_state_data_receive_data):
+		{
+			i2c_engine.byte = (i2c_engine.byte << 1) | (sda_is_high() ? 0x01 : 0x00);
+
+			if(--i2c_engine.bits > 0)
+				return(i2c_engine_clock(true));
+
+			i2c_engine_store(i2c_engine.byte);
+			state = i2c_state_data_receive_ack_send;
+
+			// ack all but the last byte
+
+			return(i2c_engine_clock(i2c_engine.received >= i2c_engine.receive_length));
+		}
+
+		case(i2c_state_data_receive_ack_send):
+		{
+			return(i2c_engine_next());
+		}
+
+		case(i2c_state_stop_send):
+		{
+			// stop condition, the next start follows after at least half a period
+
+			sda_high();
+			state = i2c_state_idle;
+
+			return(i2c_engine_done(i2c_error_ok));
+		}
+
+		default:
+		{
+			return(i2c_engine_fail(i2c_error_invalid_state_not_idle));
+		}
 	}
 }
 
-irom i2c_error_t i2c_send(int address, bool_t sendstop, int length, const uint8_t *bytes)
+irom static bool_t i2c_pending(void)
 {
-	int current;
-	i2c_error_t error;
-	bool_t ack;
+	unsigned int ix;
+
+	for(ix = 0; ix < i2c_config_queue_size; ix++)
+		if(i2c_slot[ix].status == i2c_slot_pending)
+			return(true);
+
+	return(false);
+}
+
+irom i2c_error_t i2c_queue(const i2c_transaction_t *transaction)
+{
+	i2c_slot_t *slot;
+	unsigned int ix, depth;
 
 	if(!i2c_flags.init_done)
 		return(i2c_error_no_init);
 
-	if(state != i2c_state_idle)
+	if((transaction->bus >= i2c_busses) || (transaction->priority >= i2c_priority_size))
+		return(i2c_error_invalid_bus);
+
+	for(ix = 0, depth = 0, slot = (i2c_slot_t *)0; ix < i2c_config_queue_size; ix++)
 	{
-		error = i2c_error_invalid_state_not_idle;
-		goto bail;
+		if(i2c_slot[ix].status != i2c_slot_free)
+			depth++;
+		else
+			if(!slot)
+				slot = &i2c_slot[ix];
 	}
 
-	state = i2c_state_header_send;
+	if(!slot)
+		return(i2c_error_queue_full);
+
+	slot->transaction = *transaction;
+	slot->transaction.error = i2c_error_ok;
+	slot->sequence = i2c_slot_sequence++;
+	slot->queued = read_ccount();
+	slot->status = i2c_slot_pending;
+
+	stat_i2c_queued++;
+	stat_i2c_queue_depth_total += depth;
 
-	if((error = send_header(address, i2c_direction_send)) != i2c_error_ok)
-		goto bail;
+	if(depth > stat_i2c_queue_depth_max)
+		stat_i2c_queue_depth_max = depth;
 
-	for(current = 0; current < length; current++)
+	if(state != i2c_state_error)
+		io_gpio_timer_client_start(i2c_engine_step);
+
+	return(i2c_error_ok);
+}
+
+// retire the done transactions, run their callbacks, reset the bus after
+// an error and restart the engine
+
+irom void i2c_periodic(void)
+{
+	i2c_slot_t *slot;
+	unsigned int ix;
+
+	for(ix = 0; ix < i2c_config_queue_size; ix++)
 	{
-		state = i2c_state_data_send_data;
+		slot = &i2c_slot[ix];
+
+		if(slot->status != i2c_slot_done)
+			continue;
 
-		if((error = send_byte(bytes[current])) != i2c_error_ok)
-			goto bail;
+		if(slot->transaction.callback)
+			slot->transaction.callback(&slot->transaction);
 
-		state = i2c_state_data_send_ack_receive;
+		slot->status = i2c_slot_free;
+	}
 
-		if((error = receive_ack(&ack)) != i2c_error_ok)
-			goto bail;
+	if(state == i2c_state_error)
+	{
+		i2c_reset();
 
-		state = i2c_state_data_send_ack_received;
+		if(i2c_pending())
+			io_gpio_timer_client_start(i2c_engine_step);
+	}
+}
+
+// blocking wrappers, queue the transaction and wait for it to complete,
+// the transaction goes to the bus selected with i2c_select_bus, with the
+// priority set for the device, the wait only runs i2c_periodic, so the
+// periodic tick queues its transactions instead (see io_flush_queue)
+
+typedef struct
+{
+	bool_t		done;
+	i2c_error_t	error;
+} i2c_wait_t;
+
+irom static void i2c_wait_callback(const i2c_transaction_t *transaction)
+{
+	i2c_wait_t *wait = (i2c_wait_t *)transaction->context;
+
+	wait->error = transaction->error;
+	wait->done = true;
+}
+
+// the engine didn't get to the end of the transaction in time, stop it,
+// fail the transactions it was running and the one waited for, so their
+// buffers are released, i2c_periodic then resets the bus and restarts it
+
+irom static void i2c_wait_abort(const i2c_wait_t *wait)
+{
+	i2c_slot_t *slot;
+	unsigned int ix;
+
+	io_gpio_timer_client_stop();
 
-		if(!ack)
+	for(ix = 0; ix < i2c_config_queue_size; ix++)
+	{
+		slot = &i2c_slot[ix];
+
+		if((slot->status == i2c_slot_active) ||
+				((slot->status == i2c_slot_pending) && (slot->transaction.context == wait)))
 		{
-			error = i2c_error_data_nak;
-			goto bail;
+			slot->transaction.error = i2c_error_timeout;
+			slot->status = i2c_slot_done;
 		}
 	}
 
-	if(sendstop && (error = send_stop()) != i2c_error_ok)
-		goto bail;
+	if((state != i2c_state_idle) && (state != i2c_state_error))
+		error_state = state;
 
-	return(i2c_error_ok);
+	state = i2c_state_error;
+	i2c_mux_bus = -1;
 
-bail:
-	i2c_reset();
-	return(error);
+	stat_i2c_wait_timeouts++;
 }
 
-irom i2c_error_t i2c_receive(int address, int length, uint8_t *bytes)
+irom static i2c_error_t i2c_transaction(int address, int bus, int reg, int send_length, const uint8_t *send, int receive_length, uint8_t *receive, bool_t stop)
 {
-	int current;
+	i2c_transaction_t transaction;
+	i2c_wait_t wait;
 	i2c_error_t error;
+	uint32_t start;
+
+	transaction.address = address;
+	transaction.bus = bus;
+	transaction.priority = i2c_device[address & 0x7f].priority;
+	transaction.reg = reg;
+	transaction.send_length = send_length;
+	transaction.send = send;
+	transaction.receive_length = receive_length;
+	transaction.receive = receive;
+	transaction.stop = stop;
+	transaction.callback = i2c_wait_callback;
+	transaction.context = &wait;
+
+	wait.done = false;
+	wait.error = i2c_error_ok;
+	start = system_get_time();
+
+	while((error = i2c_queue(&transaction)) == i2c_error_queue_full)
+	{
+		if((system_get_time() - start) >= i2c_config_wait_timeout_us)
+		{
+			i2c_wait_abort(&wait);
+			i2c_periodic();
 
-	if(!i2c_flags.init_done)
-		return(i2c_error_no_init);
+			return(i2c_error_timeout);
+		}
+
+		i2c_periodic();
+	}
+
+	if(error != i2c_error_ok)
+		return(error);
 
-	// state can be idle (normal) or active (repeated start)
-	if((state != i2c_state_idle) && (state != i2c_state_data_send_ack_received))
+	while(!wait.done)
 	{
-		error = i2c_error_invalid_state_not_idle;
-		goto bail;
+		if((system_get_time() - start) >= i2c_config_wait_timeout_us)
+			i2c_wait_abort(&wait);
+
+		i2c_periodic();
 	}
 
-	state = i2c_state_header_send;
+	return(wait.error);
+}
+
+iram static noinline uint32_t i2c_microdelay_cycles(void)
+{
+	uint32_t start;
+
+	start = read_ccount();
+	microdelay();
+
+	return(read_ccount() - start);
+}
+
+// calibrate the nop delay used for the stop condition and the bus reset
+// against ccount, then run probe transactions (which also detect the
+// multiplexer) and correct the timer half period until the measured clock
+// rate, which includes the interrupt latency, matches the requested speed
+
+irom static bool_t i2c_calibrate(void)
+{
+	unsigned int cycles_per_us, cycles_per_tick, target, measured, periods, round;
+	uint64_t cycles;
+	uint8_t byte;
+	bool_t multiplexer;
+	int delay, half_period;
+
+	cycles_per_us = system_get_cpu_freq();
+	cycles_per_tick = cycles_per_us / i2c_config_timer_ticks_per_us;
+	target = (cycles_per_us * 1000) / (2 * i2c_engine.speed);
+
+	i2c_bus_speed_delay = i2c_config_calibrate_loops;
+	delay = (target * i2c_config_calibrate_loops) / i2c_microdelay_cycles();
+
+	if(delay < 1)
+		delay = 1;
 
-	if((error = send_header(address, i2c_direction_receive)) != i2c_error_ok)
-		goto bail;
+	if(delay > 255)
+		delay = 255;
 
-	for(current = 0; current < length; current++)
+	i2c_bus_speed_delay = delay;
+
+	half_period = (target + (cycles_per_tick / 2)) / cycles_per_tick;
+
+	if(half_period < 1)
+		half_period = 1;
+
+	i2c_engine.half_period = half_period;
+	multiplexer = false;
+	measured = 0;
+
+	for(round = 0; round < i2c_config_calibrate_rounds; round++)
 	{
-		state = i2c_state_data_receive_data;
+		cycles = io_gpio_timer_read64(&stat_i2c_clock_cycles);
+		periods = stat_i2c_clock_periods;
+
+		multiplexer = i2c_receive(0x70, 1, &byte) == i2c_error_ok;
+
+		if((periods = stat_i2c_clock_periods - periods) == 0)
+			break;
+
+		measured = (io_gpio_timer_read64(&stat_i2c_clock_cycles) - cycles) / (2 * periods);
+
+		if((measured + (cycles_per_tick / 2)) < target)
+			half_period += (target - measured) / cycles_per_tick;
+		else
+			if(measured > (target + (cycles_per_tick / 2)))
+				half_period -= (measured - target + (cycles_per_tick / 2)) / cycles_per_tick;
+			else
+				break;
+
+		if(half_period < 1)
+			half_period = 1;
+
+		if(half_period > 255)
+			half_period = 255;
 
-		if((error = receive_byte(&bytes[current])) != i2c_error_ok)
-			goto bail;
+		if((unsigned int)half_period == i2c_engine.half_period)
+			break;
+
+		i2c_engine.half_period = half_period;
+	}
+
+	// more than 10% short after correcting, the interrupt path can't keep up
 
-		state = i2c_state_data_receive_ack_send;
+	if(measured > (target + (target / 10)))
+		i2c_engine.limited = 1;
 
-		if((error = send_ack((current + 1) < length)) != i2c_error_ok)
-			goto bail;
+	return(multiplexer);
+}
+
+irom void i2c_init(int sda_in, int scl_in)
+{
+	int address, speed;
+	string_init(varname_i2c_speed, "i2c.speed");
+
+	sda_pin = sda_in;
+	scl_pin = scl_in;
+
+	for(address = 0; address < i2c_config_devices; address++)
+	{
+		i2c_device[address].priority = i2c_priority_normal;
+		i2c_device[address].sequential = 0;
 	}
 
-	if((error = send_stop()) != i2c_error_ok)
-		goto bail;
+	i2c_mux_bus = -1;
+	i2c_bus_selected = 0;
 
-	return(i2c_error_ok);
+	i2c_flags.init_done = 1;
+
+	if(!config_get_int(&varname_i2c_speed, -1, -1, &speed))
+		speed = config_flags_get().flag.i2c_high_speed ? i2c_config_speed_high_khz : i2c_config_speed_default_khz;
+
+	if(speed < i2c_config_speed_min_khz)
+		speed = i2c_config_speed_min_khz;
+
+	i2c_engine.requested_speed = speed;
+	i2c_engine.limited = 0;
+
+	if(speed > i2c_config_speed_max_khz)
+	{
+		speed = i2c_config_speed_max_khz;
+		i2c_engine.limited = 1;
+	}
+
+	i2c_engine.speed = speed;
+	i2c_bus_speed_delay = i2c_config_calibrate_loops;
+	i2c_engine.half_period = (i2c_config_timer_ticks_per_us * 1000) / (2 * speed);
 
-bail:
 	i2c_reset();
-	return(error);
+
+	if(i2c_calibrate())
+	{
+		i2c_flags.multiplexer = 1;
+		i2c_select_bus(0);
+	}
+}
+
+irom i2c_error_t i2c_send(int address, bool_t sendstop, int length, const uint8_t *bytes)
+{
+	return(i2c_transaction(address, i2c_bus_selected, -1, length, bytes, 0, (uint8_t *)0, sendstop));
+}
+
+irom i2c_error_t i2c_receive(int address, int length, uint8_t *bytes)
+{
+	return(i2c_transaction(address, i2c_bus_selected, -1, 0, (const uint8_t *)0, length, bytes, true));
 }
 
 irom i2c_error_t i2c_send_1(int address, int byte0)
@@ -618,17 +1185,28 @@ irom i2c_error_t i2c_send_4(int address, int byte0, int byte1, int byte2, int by
 
 irom i2c_error_t i2c_send_receive(int address, int sendbyte0, int length, uint8_t *receivebytes)
 {
-	uint8_t sendbytes[1];
-	i2c_error_t rv;
+	return(i2c_transaction(address, i2c_bus_selected, sendbyte0 & 0xff, 0, (const uint8_t *)0, length, receivebytes, true));
+}
 
-	sendbytes[0] = sendbyte0 & 0xff;
+// register block transfers, for devices that auto-increment the register
+// address, one transaction for the whole block
 
-	if((rv = (i2c_send(address, false, 1, sendbytes))) != i2c_error_ok)
-		return(rv);
+irom i2c_error_t i2c_send_block(int address, int reg, int length, const uint8_t *bytes)
+{
+	return(i2c_transaction(address, i2c_bus_selected, reg & 0xff, length, bytes, 0, (uint8_t *)0, true));
+}
 
-	return(i2c_receive(address, length, receivebytes));
+irom i2c_error_t i2c_receive_block(int address, int reg, int length, uint8_t *bytes)
+{
+	return(i2c_send_receive(address, reg, length, bytes));
 }
 
+// the multiplexer isn't written here, the following transactions are
+// tagged with the bus and the engine only writes the select when the
+// cached selection differs, so returning to bus 0 costs nothing unless
+// something is actually sent on bus 0, errors from the select are
+// reported by the transaction that needed it
+
 irom i2c_error_t i2c_select_bus(unsigned int bus)
 {
 	if(!i2c_flags.multiplexer)
@@ -637,15 +1215,37 @@ irom i2c_error_t i2c_select_bus(unsigned int bus)
 	if(bus >= i2c_busses)
 		return(i2c_error_invalid_bus);
 
-	bus = 1 << bus;
-	bus >>= 1;
+	i2c_bus_selected = bus;
+	stat_i2c_select_requests++;
+
+	return(i2c_error_ok);
+}
+
+irom void i2c_set_device(int address, i2c_priority_t priority, bool_t sequential)
+{
+	if((address < 0) || (address >= i2c_config_devices) || (priority >= i2c_priority_size))
+		return;
 
-	return(i2c_send_1(0x70, bus));
+	i2c_device[address].priority = priority;
+	i2c_device[address].sequential = sequential ? 1 : 0;
 }
 
 irom void i2c_get_info(i2c_info_t *i2c_info)
 {
+	uint64_t clock_cycles;
+
 	i2c_info->multiplexer = i2c_flags.multiplexer ? 1 : 0;
 	i2c_info->buses = i2c_flags.multiplexer ? i2c_busses : 1;
 	i2c_info->delay = i2c_bus_speed_delay;
+	i2c_info->half_period = i2c_engine.half_period;
+	i2c_info->speed = i2c_engine.speed;
+	i2c_info->requested_speed = i2c_engine.requested_speed;
+	i2c_info->limited = i2c_engine.limited;
+
+	clock_cycles = io_gpio_timer_read64(&stat_i2c_clock_cycles);
+
+	if(clock_cycles > 0)
+		i2c_info->measured_speed = ((uint64_t)stat_i2c_clock_periods * system_get_cpu_freq() * 1000000) / clock_cycles;
+	else
+		i2c_info->measured_speed = 0;
 }
@@ -51,6 +51,8 @@ typedef enum
 	i2c_error_device_error_4,
 	i2c_error_device_error_5,
 	i2c_error_invalid_bus,
+	i2c_error_queue_full,
+	i2c_error_timeout,
 	i2c_error_error,
 	i2c_error_size = i2c_error_error
 } i2c_error_t;
@@ -62,14 +64,65 @@ typedef struct attr_packed
 	unsigned int multiplexer:1;
 	unsigned int buses:7;
 	unsigned int delay:8;
+	unsigned int half_period:8;			// timer ticks
+	unsigned int speed:16;				// kHz
+	unsigned int measured_speed:24;		// Hz
+	unsigned int requested_speed:16;	// kHz
+	unsigned int limited:1;				// by the timer interrupt rate
+	unsigned int spare:15;
 } i2c_info_t;
 
-assert_size(i2c_info_t, 2);
+assert_size(i2c_info_t, 12);
+
+typedef enum
+{
+	i2c_priority_low = 0,		// slow sensor conversions
+	i2c_priority_normal,
+	i2c_priority_high,			// io expanders
+	i2c_priority_size,
+} i2c_priority_t;
+
+assert_size(i2c_priority_t, 4);
+
+// asynchronous transactions, the register byte (if any) and the send bytes
+// are written, then, after a repeated start, the receive bytes are read,
+// the buffers must remain valid until the callback has been called
+//
+// pending transactions are started highest priority first, then those on
+// the currently selected multiplexer bus, then in queue order, plain
+// register reads from the same device that continue each other are merged
+// into one transaction if the device auto-increments the register address,
+// after a transaction with stop = false, only one for the same address and
+// bus follows with a repeated start, if there is none while others are
+// waiting, the bus is released with a stop condition
+
+typedef struct i2c_transaction_T i2c_transaction_t;
+
+typedef void (*i2c_callback_t)(const i2c_transaction_t *);
+
+struct i2c_transaction_T
+{
+	int				address;
+	int				bus;				// multiplexer bus, -1 = any
+	i2c_priority_t	priority;
+	int				reg;				// -1 = none
+	int				send_length;
+	const uint8_t	*send;
+	int				receive_length;
+	uint8_t			*receive;
+	bool_t			stop;				// false = keep the bus for the next transaction (repeated start)
+	i2c_callback_t	callback;			// called from i2c_periodic (task context), may be null
+	void			*context;
+	i2c_error_t		error;
+};
 
 void		i2c_init(int sda_index, int scl_index);
+i2c_error_t	i2c_queue(const i2c_transaction_t *);
+void		i2c_periodic(void);
 i2c_error_t	i2c_send(int address, bool_t sendstop, int length, const uint8_t *bytes);
 void		i2c_error_format_string(string_t *dst, i2c_error_t error);
 i2c_error_t	i2c_select_bus(unsigned int bus);
+void		i2c_set_device(int address, i2c_priority_t priority, bool_t sequential);
 void		i2c_get_info(i2c_info_t *);
 
 i2c_error_t	i2c_receive(int address, int length, uint8_t *bytes);
@@ -79,4 +132,6 @@ i2c_error_t	i2c_send_3(int address, int byte0, int byte1, int byte2);
 i2c_error_t	i2c_send_4(int address, int byte0, int byte1, int byte2, int byte3);
 
 i2c_error_t	i2c_send_receive(int address, int sendbyte0, int length, uint8_t *bytes);
+i2c_error_t	i2c_send_block(int address, int reg, int length, const uint8_t *bytes);
+i2c_error_t	i2c_receive_block(int address, int reg, int length, uint8_t *bytes);
 #endif
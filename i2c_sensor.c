@@ -2175,6 +2175,7 @@ irom i2c_error_t i2c_sensor_init(int bus, i2c_sensor_t sensor)
 	}
 
 	device_data[entry->id].detected |= 1 << bus;
+	i2c_set_device(entry->address, i2c_priority_low, false);
 	i2c_select_bus(0);
 	return(i2c_error_ok);
 }
@@ -5,8 +5,11 @@
 #include "io.h"
 #include "i2c.h"
 #include "config.h"
+#include "stats.h"
 #include "util.h"
 
+#include <user_interface.h>
+
 io_config_pin_entry_t io_config[io_id_size][max_pins_per_io];
 
 io_info_t io_info =
@@ -25,6 +28,8 @@ io_info_t io_info =
 			.i2c = 1,
 			.uart = 1,
 			.pullup = 1,
+			.frequency = 1,
+			.servo = 1,
 		},
 		"Internal GPIO",
 		io_gpio_init,
@@ -33,6 +38,9 @@ io_info_t io_info =
 		io_gpio_get_pin_info,
 		io_gpio_read_pin,
 		io_gpio_write_pin,
+		io_gpio_write_mask,
+		io_gpio_read_port,
+		io_gpio_flush,
 	},
 	{
 		/* io_id_aux = 1 */
@@ -48,6 +56,8 @@ io_info_t io_info =
 			.i2c = 0,
 			.uart = 0,
 			.pullup = 0,
+			.frequency = 1,
+			.servo = 0,
 		},
 		"Auxilliary GPIO (RTC+ADC)",
 		io_aux_init,
@@ -56,6 +66,9 @@ io_info_t io_info =
 		io_aux_get_pin_info,
 		io_aux_read_pin,
 		io_aux_write_pin,
+		0,
+		0,
+		0,
 	},
 	{
 		/* io_id_mcp_20 = 2 */
@@ -71,6 +84,8 @@ io_info_t io_info =
 			.i2c = 0,
 			.uart = 0,
 			.pullup = 1,
+			.frequency = 0,
+			.servo = 0,
 		},
 		"MCP23017 I2C I/O expander #1",
 		io_mcp_init,
@@ -79,6 +94,9 @@ io_info_t io_info =
 		io_mcp_get_pin_info,
 		io_mcp_read_pin,
 		io_mcp_write_pin,
+		io_mcp_write_mask,
+		io_mcp_read_port,
+		0,
 	},
 	{
 		/* io_id_mcp_21 = 3 */
@@ -94,6 +112,8 @@ io_info_t io_info =
 			.i2c = 0,
 			.uart = 0,
 			.pullup = 1,
+			.frequency = 0,
+			.servo = 0,
 		},
 		"MCP23017 I2C I/O expander #2",
 		io_mcp_init,
@@ -102,6 +122,9 @@ io_info_t io_info =
 		io_mcp_get_pin_info,
 		io_mcp_read_pin,
 		io_mcp_write_pin,
+		io_mcp_write_mask,
+		io_mcp_read_port,
+		0,
 	},
 	{
 		/* io_id_pcf_3a = 4 */
@@ -117,6 +140,8 @@ io_info_t io_info =
 			.i2c = 0,
 			.uart = 0,
 			.pullup = 0,
+			.frequency = 0,
+			.servo = 0,
 		},
 		"PCF8574A I2C I/O expander",
 		io_pcf_init,
@@ -125,11 +150,171 @@ io_info_t io_info =
 		0,
 		io_pcf_read_pin,
 		io_pcf_write_pin,
+		io_pcf_write_mask,
+		io_pcf_read_port,
+		io_pcf_flush,
 	}
 };
 
 static io_data_t io_data;
 
+typedef enum
+{
+	io_worklist_trigger,
+	io_worklist_output_analog,
+	io_worklist_size,
+} io_worklist_t;
+
+typedef struct
+{
+	uint8_t io;
+	uint8_t pin;
+} io_worklist_entry_t;
+
+typedef struct
+{
+	unsigned int length;
+	io_worklist_entry_t entry[io_id_size * max_pins_per_io];
+} io_worklist_entries_t;
+
+static io_worklist_entries_t io_worklist[io_worklist_size];
+
+// timer pins are kept in a min-heap ordered by deadline (in us, system
+// time), so only expired timers are touched, deadlines that fall between
+// two ticks are handled by a one-shot os timer
+
+enum
+{
+	io_timer_none = 0xff,
+	io_timer_tick_us = 10000,
+};
+
+typedef struct
+{
+	uint32_t	deadline;
+	uint8_t		io;
+	uint8_t		pin;
+} io_timer_entry_t;
+
+// pin change journal, a ring buffer of the most recent events, every
+// event gets a sequence number, clients drain the events since the last
+// sequence number they've seen
+
+enum
+{
+	io_journal_size = 64,
+};
+
+static io_journal_entry_t io_journal[io_journal_size];
+static uint32_t io_journal_next;		// sequence number of the next event
+static uint32_t io_journal_drained;		// sequence number of the oldest event not drained yet
+
+static io_timer_entry_t io_timer_heap[io_id_size * max_pins_per_io];
+static unsigned int io_timer_heap_size;
+static uint8_t io_timer_heap_index[io_id_size][max_pins_per_io];
+static os_timer_t io_timer_short;
+
+// analog output fades, the value follows a curve from a lookup table in
+// flash, perceptual (gamma) curves fade in the lightness domain, all
+// pins fading are updated in one pass per tick, the driver applies all
+// changes at once in its flush function
+
+enum
+{
+	io_fade_slots = 8,
+	io_fade_table_entries = 65,
+	io_fade_table_shift = 10,
+	io_fade_duration_max_ms = 600000,
+};
+
+typedef enum
+{
+	io_fade_linear = 0,
+	io_fade_gamma,
+	io_fade_in,
+	io_fade_out,
+	io_fade_inout,
+	io_fade_curve_size,
+} io_fade_curve_t;
+
+typedef enum
+{
+	io_fade_table_gamma = 0,
+	io_fade_table_in,
+	io_fade_table_out,
+	io_fade_table_inout,
+	io_fade_table_size,
+} io_fade_table_t;
+
+typedef struct
+{
+	unsigned int	active:1;
+	uint8_t			io;
+	uint8_t			pin;
+	io_fade_curve_t	curve;
+	unsigned int	from;
+	unsigned int	to;
+	unsigned int	target;
+	unsigned int	full_scale;
+	uint32_t		start;
+	uint32_t		duration_us;
+} io_fade_t;
+
+static io_fade_t io_fade[io_fade_slots];
+
+static const roflash uint32_t io_fade_table[io_fade_table_size][io_fade_table_entries] =
+{
+	{	// gamma, cie 1931 lightness to luminance
+		    0,   113,   227,   340,   453,   567,   686,   821,
+		  972,  1141,  1328,  1535,  1762,  2010,  2281,  2575,
+		 2894,  3237,  3607,  4004,  4429,  4883,  5367,  5882,
+		 6429,  7009,  7623,  8272,  8956,  9677, 10436, 11234,
+		12071, 12948, 13868, 14830, 15835, 16885, 17980, 19121,
+		20310, 21547, 22833, 24170, 25558, 26997, 28490, 30037,
+		31639, 33297, 35012, 36785, 38616, 40507, 42460, 44473,
+		46550, 48690, 50895, 53166, 55503, 57907, 60380, 62922,
+		65535,
+	},
+	{	// ease in, cubic
+		    0,     0,     2,     7,    16,    31,    54,    86,
+		  128,   182,   250,   333,   432,   549,   686,   844,
+		 1024,  1228,  1458,  1715,  2000,  2315,  2662,  3042,
+		 3456,  3906,  4394,  4921,  5488,  6097,  6750,  7448,
+		 8192,  8984,  9826, 10719, 11664, 12663, 13718, 14830,
+		16000, 17230, 18522, 19876, 21296, 22781, 24334, 25955,
+		27648, 29412, 31250, 33162, 35151, 37219, 39365, 41593,
+		43903, 46298, 48777, 51344, 53999, 56744, 59581, 62511,
+		65535,
+	},
+	{	// ease out, cubic
+		    0,  3024,  5954,  8791, 11536, 14191, 16758, 19237,
+		21632, 23942, 26170, 28316, 30384, 32373, 34285, 36123,
+		37887, 39580, 41201, 42754, 44239, 45659, 47013, 48305,
+		49535, 50705, 51817, 52872, 53871, 54816, 55709, 56551,
+		57343, 58087, 58785, 59438, 60047, 60614, 61141, 61629,
+		62079, 62493, 62873, 63220, 63535, 63820, 64077, 64307,
+		64511, 64691, 64849, 64986, 65103, 65202, 65285, 65353,
+		65407, 65449, 65481, 65504, 65519, 65528, 65533, 65535,
+		65535,
+	},
+	{	// ease in and out, cubic
+		    0,     1,     8,    27,    64,   125,   216,   343,
+		  512,   729,  1000,  1331,  1728,  2197,  2744,  3375,
+		 4096,  4913,  5832,  6859,  8000,  9261, 10648, 12167,
+		13824, 15625, 17576, 19683, 21952, 24389, 27000, 29791,
+		32768, 35744, 38535, 41146, 43583, 45852, 47959, 49910,
+		51711, 53368, 54887, 56274, 57535, 58676, 59703, 60622,
+		61439, 62160, 62791, 63338, 63807, 64204, 64535, 64806,
+		65023, 65192, 65319, 65410, 65471, 65508, 65527, 65534,
+		65535,
+	},
+};
+
+static const char *io_fade_curve_names[io_fade_curve_size] =
+{
+	"linear", "gamma", "in", "out", "inout",
+};
+
 typedef struct
 {
 	io_pin_mode_t	mode;
@@ -150,6 +335,8 @@ static io_mode_trait_t io_mode_traits[io_pin_size] =
 	{ io_pin_uart,				"uart",			"uart"					},
 	{ io_pin_lcd,				"lcd",			"lcd"					},
 	{ io_pin_trigger,			"trigger",		"trigger"				},
+	{ io_pin_frequency,			"frequency",	"frequency"				},
+	{ io_pin_servo,				"servo",		"servo (rc pulse)"		},
 };
 
 irom static io_pin_mode_t io_mode_from_string(const string_t *src)
@@ -226,6 +413,8 @@ static io_ll_mode_trait_t io_ll_mode_traits[io_pin_ll_size] =
 	{ io_pin_ll_output_analog,		"analog output"		},
 	{ io_pin_ll_i2c,				"i2c"				},
 	{ io_pin_ll_uart,				"uart"				},
+	{ io_pin_ll_frequency,			"frequency"			},
+	{ io_pin_ll_servo,				"servo"				},
 };
 
 irom void io_string_from_ll_mode(string_t *name, io_pin_ll_mode_t mode, int pad)
@@ -253,6 +442,299 @@ irom void io_string_from_ll_mode(string_t *name, io_pin_ll_mode_t mode, int pad)
 	string_append(name, "error");
 }
 
+// frequency measurement, the edges are timestamped by the driver (in cpu
+// cycles), at the end of every gate time the mean period of the edges
+// within the gate is fed into a moving average
+
+enum
+{
+	io_frequency_timeout_ms = 10000,
+};
+
+irom void io_frequency_init(io_frequency_t *frequency)
+{
+	frequency->edges = 0;
+	frequency->first = 0;
+	frequency->last = 0;
+	frequency->period = 0;
+	frequency->average = 0;
+	frequency->gate_start = read_ccount();
+}
+
+iram void io_frequency_gate(io_frequency_t *frequency, const io_config_pin_entry_t *pin_config, uint32_t now)
+{
+	uint32_t cycles_per_ms, period;
+	unsigned int average;
+
+	cycles_per_ms = system_get_cpu_freq() * 1000;
+
+	if((now - frequency->gate_start) < (pin_config->speed * cycles_per_ms))
+		return;
+
+	frequency->gate_start = now;
+
+	if(frequency->edges >= 2)
+	{
+		period = (frequency->last - frequency->first) / (frequency->edges - 1);
+		average = pin_config->shared.frequency.average;
+
+		if((frequency->average == 0) || (average < 2))
+			frequency->average = period;
+		else
+			if(period > frequency->average)
+				frequency->average += (period - frequency->average) / average;
+			else
+				frequency->average -= (frequency->average - period) / average;
+
+		// next gate starts at the last edge of this gate
+
+		frequency->first = frequency->last;
+		frequency->edges = 1;
+	}
+	else
+	{
+		// too few edges, extend the gate, unless the input has gone quiet
+
+		if((frequency->edges == 0) || ((now - frequency->last) > (io_frequency_timeout_ms * cycles_per_ms)))
+		{
+			frequency->edges = 0;
+			frequency->period = 0;
+			frequency->average = 0;
+		}
+	}
+}
+
+irom attr_pure unsigned int io_frequency_value(const io_frequency_t *frequency)
+{
+	uint32_t cycles_per_s;
+
+	if(frequency->average == 0)
+		return(0);
+
+	cycles_per_s = system_get_cpu_freq() * 1000000;
+
+	return((cycles_per_s + (frequency->average / 2)) / frequency->average);
+}
+
+irom void io_frequency_info(string_t *dst, const io_frequency_t *frequency)
+{
+	unsigned int cycles_per_us;
+
+	cycles_per_us = system_get_cpu_freq();
+
+	string_format(dst, "frequency: %u Hz, average period: %u us, last period: %u us",
+			io_frequency_value(frequency),
+			frequency->average / cycles_per_us,
+			frequency->period / cycles_per_us);
+}
+
+// table lookup, input and output 0 - 65535, linear interpolation between entries
+
+iram attr_pure static unsigned int io_fade_lookup(io_fade_table_t table, unsigned int x)
+{
+	unsigned int ix, fraction, a, b;
+
+	ix = x >> io_fade_table_shift;
+	fraction = x & ((1 << io_fade_table_shift) - 1);
+
+	a = io_fade_table[table][ix];
+	b = io_fade_table[table][ix + 1];
+
+	return(a + (((b - a) * fraction) >> io_fade_table_shift));
+}
+
+irom attr_pure static unsigned int io_fade_lookup_inverse(io_fade_table_t table, unsigned int y)
+{
+	unsigned int low, high, mid, a, b;
+
+	low = 0;
+	high = io_fade_table_entries - 1;
+
+	while((high - low) > 1)
+	{
+		mid = (low + high) / 2;
+
+		if(io_fade_table[table][mid] <= y)
+			low = mid;
+		else
+			high = mid;
+	}
+
+	a = io_fade_table[table][low];
+	b = io_fade_table[table][high];
+
+	if(y >= b)
+		return(high << io_fade_table_shift);
+
+	return((low << io_fade_table_shift) + (((y - a) << io_fade_table_shift) / (b - a)));
+}
+
+irom static io_fade_curve_t io_fade_curve_from_string(const string_t *src)
+{
+	io_fade_curve_t curve;
+
+	for(curve = 0; curve < io_fade_curve_size; curve++)
+		if(string_match_cstr(src, io_fade_curve_names[curve]))
+			return(curve);
+
+	return(io_fade_curve_size);
+}
+
+iram static void io_fade_cancel(int io, int pin)
+{
+	unsigned int slot;
+
+	for(slot = 0; slot < io_fade_slots; slot++)
+		if(io_fade[slot].active && (io_fade[slot].io == io) && (io_fade[slot].pin == pin))
+			io_fade[slot].active = 0;
+}
+
+iram static unsigned int io_fade_value(const io_fade_t *fade, uint32_t now)
+{
+	unsigned int progress, from, to, value;
+	uint32_t elapsed;
+
+	elapsed = now - fade->start;
+
+	if(elapsed >= fade->duration_us)
+		return(fade->target);
+
+	progress = ((uint64_t)elapsed * 65535) / fade->duration_us;
+
+	switch(fade->curve)
+	{
+		case(io_fade_in):		{ progress = io_fade_lookup(io_fade_table_in, progress); break; }
+		case(io_fade_out):		{ progress = io_fade_lookup(io_fade_table_out, progress); break; }
+		case(io_fade_inout):	{ progress = io_fade_lookup(io_fade_table_inout, progress); break; }
+		default:				{ break; }
+	}
+
+	from = fade->from;
+	to = fade->to;
+
+	if(to >= from)
+		value = from + (((to - from) * progress) / 65535);
+	else
+		value = from - (((from - to) * progress) / 65535);
+
+	// from and to are stored as lightness for all curves but linear
+
+	if(fade->curve != io_fade_linear)
+		value = io_fade_lookup(io_fade_table_gamma, value);
+
+	// the tables work on 0 - 65535, scale back to the pin's duty range
+
+	return(((uint64_t)value * fade->full_scale) / 65535);
+}
+
+iram static void io_fade_periodic(uint32_t now)
+{
+	const io_info_entry_t *info;
+	io_fade_t *fade;
+	unsigned int slot;
+
+	for(slot = 0; slot < io_fade_slots; slot++)
+	{
+		fade = &io_fade[slot];
+
+		if(!fade->active)
+			continue;
+
+		info = &io_info[fade->io];
+
+		info->write_pin_fn((string_t *)0, info, &io_data[fade->io].pin[fade->pin], &io_config[fade->io][fade->pin],
+				fade->pin, io_fade_value(fade, now));
+
+		if((now - fade->start) >= fade->duration_us)
+			fade->active = 0;
+	}
+}
+
+irom static io_error_t io_fade_start(string_t *error, int io, int pin, unsigned int to, unsigned int duration_ms, io_fade_curve_t curve)
+{
+	io_data_pin_entry_t *pin_data;
+	io_config_pin_entry_t *pin_config;
+	io_fade_t *fade;
+	io_pin_mode_t mode;
+	unsigned int slot, full_scale;
+	int from, low, high, step;
+
+	pin_config = &io_config[io][pin];
+	pin_data = &io_data[io].pin[pin];
+
+	if(pin_config->mode != io_pin_output_analog)
+	{
+		if(error)
+			string_append(error, "pin is not an analog output\n");
+		return(io_error);
+	}
+
+	if(io_traits(error, io, pin, &mode, &low, &high, &step, &from) != io_ok)
+		return(io_error);
+
+	// the curves are tabulated for 0 - 65535, the duty range of the
+	// pin depends on the pwm period and dithering
+
+	full_scale = io_gpio_pwm_range() - 1;
+
+	if((full_scale < 1) || (to > full_scale))
+	{
+		if(error)
+			string_format(error, "value out of range (0 - %u)\n", full_scale);
+		return(io_error);
+	}
+
+	io_fade_cancel(io, pin);
+
+	for(slot = 0; slot < io_fade_slots; slot++)
+		if(!io_fade[slot].active)
+			break;
+
+	if(slot >= io_fade_slots)
+	{
+		if(error)
+			string_append(error, "no free fade slots\n");
+		return(io_error);
+	}
+
+	// stop a running ramp, the fade takes over
+
+	pin_data->direction = io_dir_none;
+
+	if(from < 0)
+		from = 0;
+
+	if((unsigned int)from > full_scale)
+		from = full_scale;
+
+	fade = &io_fade[slot];
+	fade->io = io;
+	fade->pin = pin;
+	fade->curve = curve;
+	fade->target = to;
+	fade->full_scale = full_scale;
+	fade->start = system_get_time();
+	fade->duration_us = duration_ms * 1000;
+
+	from = ((uint64_t)from * 65535) / full_scale;
+	to = ((uint64_t)to * 65535) / full_scale;
+
+	if(curve == io_fade_linear)
+	{
+		fade->from = from;
+		fade->to = to;
+	}
+	else
+	{
+		fade->from = io_fade_lookup_inverse(io_fade_table_gamma, from);
+		fade->to = io_fade_lookup_inverse(io_fade_table_gamma, to);
+	}
+
+	fade->active = 1;
+
+	return(io_ok);
+}
+
 irom static io_i2c_t io_i2c_pin_from_string(const string_t *pin)
 {
 	if(string_match_cstr(pin, "sda"))
@@ -496,6 +978,8 @@ irom static io_error_t io_read_pin_x(string_t *errormsg, const io_info_entry_t *
 		case(io_pin_uart):
 		case(io_pin_lcd):
 		case(io_pin_trigger):
+		case(io_pin_frequency):
+		case(io_pin_servo):
 		{
 			if((error = info->read_pin_fn(errormsg, info, pin_data, pin_config, pin, value)) != io_ok)
 				return(error);
@@ -507,77 +991,242 @@ irom static io_error_t io_read_pin_x(string_t *errormsg, const io_info_entry_t *
 	return(io_ok);
 }
 
-irom static io_error_t io_write_pin_x(string_t *errormsg, const io_info_entry_t *info, io_data_pin_entry_t *pin_data, io_config_pin_entry_t *pin_config, int pin, int value)
+always_inline static bool_t io_timer_before(uint32_t a, uint32_t b)
 {
-	io_error_t error;
+	return((int32_t)(a - b) < 0);
+}
 
-	switch(pin_config->mode)
+iram static void io_timer_heap_set(unsigned int index, const io_timer_entry_t *entry)
+{
+	io_timer_heap[index] = *entry;
+	io_timer_heap_index[entry->io][entry->pin] = index;
+}
+
+iram static void io_timer_heap_sift(unsigned int index)
+{
+	io_timer_entry_t entry = io_timer_heap[index];
+	unsigned int parent, child;
+
+	while(index > 0)
 	{
-		case(io_pin_disabled):
-		case(io_pin_input_digital):
-		case(io_pin_input_analog):
-		case(io_pin_i2c):
-		case(io_pin_uart):
-		case(io_pin_error):
-		case(io_pin_trigger):
-		{
-			if(errormsg)
-				string_append(errormsg, "cannot write to this pin");
+		parent = (index - 1) / 2;
 
-			return(io_error);
-		}
+		if(!io_timer_before(entry.deadline, io_timer_heap[parent].deadline))
+			break;
 
-		case(io_pin_counter):
-		case(io_pin_output_digital):
-		case(io_pin_lcd):
-		case(io_pin_timer):
-		case(io_pin_output_analog):
-		{
-			if((error = info->write_pin_fn(errormsg, info, pin_data, pin_config, pin, value)) != io_ok)
-				return(error);
+		io_timer_heap_set(index, &io_timer_heap[parent]);
+		index = parent;
+	}
+
+	for(;;)
+	{
+		child = (index * 2) + 1;
 
+		if(child >= io_timer_heap_size)
 			break;
-		}
+
+		if(((child + 1) < io_timer_heap_size) && io_timer_before(io_timer_heap[child + 1].deadline, io_timer_heap[child].deadline))
+			child++;
+
+		if(!io_timer_before(io_timer_heap[child].deadline, entry.deadline))
+			break;
+
+		io_timer_heap_set(index, &io_timer_heap[child]);
+		index = child;
 	}
 
-	return(io_ok);
+	io_timer_heap_set(index, &entry);
 }
 
-irom static io_error_t io_trigger_pin_x(string_t *errormsg, const io_info_entry_t *info, io_data_pin_entry_t *pin_data, io_config_pin_entry_t *pin_config, int pin, io_trigger_t trigger_type)
+iram static void io_timer_cancel(int io, int pin)
 {
-	io_error_t error;
-	int value = 0, old_value, trigger;
+	unsigned int index = io_timer_heap_index[io][pin];
 
-	switch(pin_config->mode)
-	{
-		case(io_pin_disabled):
-		case(io_pin_input_digital):
-		case(io_pin_input_analog):
-		case(io_pin_i2c):
-		case(io_pin_uart):
-		case(io_pin_error):
-		{
-			if(errormsg)
-				string_append(errormsg, "cannot trigger this pin");
+	if(index == io_timer_none)
+		return;
 
-			return(io_error);
-		}
+	io_timer_heap_index[io][pin] = io_timer_none;
 
-		case(io_pin_output_digital):
-		case(io_pin_lcd):
-		{
-			switch(trigger_type)
-			{
-				case(io_trigger_down):
-				{
-					if((error = info->write_pin_fn(errormsg, info, pin_data, pin_config, pin, 0)) != io_ok)
-						return(error);
+	if(--io_timer_heap_size == index)
+		return;
 
-					break;
-				}
+	io_timer_heap_set(index, &io_timer_heap[io_timer_heap_size]);
+	io_timer_heap_sift(index);
+}
 
-				case(io_trigger_up):
-				{
+iram static void io_timer_schedule(int io, int pin, uint32_t deadline)
+{
+	io_timer_entry_t entry = { deadline, io, pin };
+
+	io_timer_cancel(io, pin);
+	io_timer_heap_set(io_timer_heap_size++, &entry);
+	io_timer_heap_sift(io_timer_heap_size - 1);
+}
+
+irom static unsigned int io_timer_remaining_ms(int io, int pin)
+{
+	unsigned int index = io_timer_heap_index[io][pin];
+	int32_t remaining;
+
+	if(index == io_timer_none)
+		return(0);
+
+	remaining = io_timer_heap[index].deadline - system_get_time();
+
+	return((remaining > 0) ? (remaining / 1000) : 0);
+}
+
+iram static void io_timer_expire(uint32_t now)
+{
+	const io_info_entry_t *info;
+	io_config_pin_entry_t *pin_config;
+	io_data_pin_entry_t *pin_data;
+	io_timer_entry_t entry;
+	uint32_t deadline;
+	unsigned int delay;
+
+	while((io_timer_heap_size > 0) && !io_timer_before(now, io_timer_heap[0].deadline))
+	{
+		entry = io_timer_heap[0];
+		io_timer_cancel(entry.io, entry.pin);
+
+		info = &io_info[entry.io];
+		pin_config = &io_config[entry.io][entry.pin];
+		pin_data = &io_data[entry.io].pin[entry.pin];
+
+		switch(pin_data->direction)
+		{
+			case(io_dir_none):
+			{
+				break;
+			}
+
+			case(io_dir_up):
+			{
+				info->write_pin_fn((string_t *)0, info, pin_data, pin_config, entry.pin, 1);
+				pin_data->direction = io_dir_down;
+				break;
+			}
+
+			case(io_dir_down):
+			{
+				info->write_pin_fn((string_t *)0, info, pin_data, pin_config, entry.pin, 0);
+				pin_data->direction = io_dir_up;
+				break;
+			}
+		}
+
+		if(pin_config->flags.repeat)
+		{
+			// schedule relative to the previous deadline, so repeating timers don't drift
+
+			deadline = entry.deadline + (pin_config->speed * 1000);
+
+			if(io_timer_before(deadline, now))
+				deadline = now + (pin_config->speed * 1000);
+
+			io_timer_schedule(entry.io, entry.pin, deadline);
+		}
+		else
+			pin_data->direction = io_dir_none;
+	}
+
+	// next deadline is before the next tick, take care of it using a one-shot timer
+
+	os_timer_disarm(&io_timer_short);
+
+	if((io_timer_heap_size > 0) && io_timer_before(io_timer_heap[0].deadline, now + io_timer_tick_us))
+	{
+		delay = (io_timer_heap[0].deadline - now + 999) / 1000;
+
+		if(delay < 1)
+			delay = 1;
+
+		os_timer_arm(&io_timer_short, delay, 0);
+	}
+}
+
+iram static void io_timer_short_callback(void *arg)
+{
+	io_timer_expire(system_get_time());
+	io_flush_queue();
+}
+
+irom static io_error_t io_write_pin_x(string_t *errormsg, const io_info_entry_t *info, io_data_pin_entry_t *pin_data, io_config_pin_entry_t *pin_config, int pin, int value)
+{
+	io_error_t error;
+
+	switch(pin_config->mode)
+	{
+		case(io_pin_disabled):
+		case(io_pin_input_digital):
+		case(io_pin_input_analog):
+		case(io_pin_i2c):
+		case(io_pin_uart):
+		case(io_pin_error):
+		case(io_pin_trigger):
+		case(io_pin_frequency):
+		{
+			if(errormsg)
+				string_append(errormsg, "cannot write to this pin");
+
+			return(io_error);
+		}
+
+		case(io_pin_counter):
+		case(io_pin_output_digital):
+		case(io_pin_lcd):
+		case(io_pin_timer):
+		case(io_pin_output_analog):
+		case(io_pin_servo):
+		{
+			if((error = info->write_pin_fn(errormsg, info, pin_data, pin_config, pin, value)) != io_ok)
+				return(error);
+
+			break;
+		}
+	}
+
+	return(io_ok);
+}
+
+irom static io_error_t io_trigger_pin_x(string_t *errormsg, const io_info_entry_t *info, io_data_pin_entry_t *pin_data, io_config_pin_entry_t *pin_config, int pin, io_trigger_t trigger_type)
+{
+	io_error_t error;
+	int value = 0, old_value, trigger;
+
+	switch(pin_config->mode)
+	{
+		case(io_pin_disabled):
+		case(io_pin_input_digital):
+		case(io_pin_input_analog):
+		case(io_pin_i2c):
+		case(io_pin_uart):
+		case(io_pin_frequency):
+		case(io_pin_servo):
+		case(io_pin_error):
+		{
+			if(errormsg)
+				string_append(errormsg, "cannot trigger this pin");
+
+			return(io_error);
+		}
+
+		case(io_pin_output_digital):
+		case(io_pin_lcd):
+		{
+			switch(trigger_type)
+			{
+				case(io_trigger_down):
+				{
+					if((error = info->write_pin_fn(errormsg, info, pin_data, pin_config, pin, 0)) != io_ok)
+						return(error);
+
+					break;
+				}
+
+				case(io_trigger_up):
+				{
 					if((error = info->write_pin_fn(errormsg, info, pin_data, pin_config, pin, 1)) != io_ok)
 						return(error);
 
@@ -649,7 +1298,7 @@ irom static io_error_t io_trigger_pin_x(string_t *errormsg, const io_info_entry_
 					if((error = info->write_pin_fn(errormsg, info, pin_data, pin_config, pin, value)) != io_ok)
 						return(error);
 
-					pin_data->speed = 0;
+					io_timer_cancel(info - io_info, pin);
 					pin_data->direction = io_dir_none;
 
 					break;
@@ -662,7 +1311,7 @@ irom static io_error_t io_trigger_pin_x(string_t *errormsg, const io_info_entry_
 					if((error = info->write_pin_fn(errormsg, info, pin_data, pin_config, pin, value)) != io_ok)
 						return(error);
 
-					pin_data->speed = pin_config->speed;
+					io_timer_schedule(info - io_info, pin, system_get_time() + (pin_config->speed * 1000));
 					pin_data->direction = pin_config->direction;
 
 					break;
@@ -891,9 +1540,221 @@ irom io_error_t io_write_pin(string_t *error, int io, int pin, int value)
 	pin_config = &io_config[io][pin];
 	pin_data = &data->pin[pin];
 
+	io_fade_cancel(io, pin);
+
 	return(io_write_pin_x(error, info, pin_data, pin_config, pin, value));
 }
 
+irom io_error_t io_write_mask(string_t *error, int io, unsigned int mask, unsigned int values)
+{
+	const io_info_entry_t *info;
+	io_data_entry_t *data;
+	io_config_pin_entry_t *pin_config;
+	io_data_pin_entry_t *pin_data;
+	int pin;
+
+	if(io >= io_id_size)
+	{
+		if(error)
+			string_append(error, "io out of range\n");
+		return(io_error);
+	}
+
+	info = &io_info[io];
+	data = &io_data[io];
+
+	if(mask & ~((1U << info->pins) - 1))
+	{
+		if(error)
+			string_append(error, "pin out of range\n");
+		return(io_error);
+	}
+
+	for(pin = 0; pin < info->pins; pin++)
+	{
+		if(!(mask & (1 << pin)))
+			continue;
+
+		if(io_config[io][pin].mode != io_pin_output_digital)
+		{
+			if(error)
+				string_format(error, "pin %d is not a digital output\n", pin);
+			return(io_error);
+		}
+	}
+
+	// update all pins at once if the driver supports it, otherwise one by one
+
+	if(info->write_mask_fn)
+		return(info->write_mask_fn(error, info, mask, values));
+
+	for(pin = 0; pin < info->pins; pin++)
+	{
+		if(!(mask & (1 << pin)))
+			continue;
+
+		pin_config = &io_config[io][pin];
+		pin_data = &data->pin[pin];
+
+		if(info->write_pin_fn(error, info, pin_data, pin_config, pin, !!(values & (1 << pin))) != io_ok)
+			return(io_error);
+	}
+
+	return(io_ok);
+}
+
+irom static io_error_t io_read_all(string_t *error, int io, unsigned int *enabled, int *values)
+{
+	const io_info_entry_t *info;
+	const io_config_pin_entry_t *pin_config;
+	unsigned int port, digital;
+	int pin;
+
+	info = &io_info[io];
+	*enabled = 0;
+	digital = 0;
+
+	if(!io_data[io].detected)
+		return(io_ok);
+
+	for(pin = 0; pin < info->pins; pin++)
+	{
+		pin_config = &io_config[io][pin];
+
+		if((pin_config->mode == io_pin_disabled) || (pin_config->mode == io_pin_error))
+			continue;
+
+		*enabled |= 1 << pin;
+
+		if((pin_config->llmode == io_pin_ll_input_digital) || (pin_config->llmode == io_pin_ll_output_digital))
+			digital |= 1 << pin;
+	}
+
+	// digital pins are taken from one read of the whole port, if the driver
+	// supports it, the rest (counters, analog etc.) is read pin by pin
+
+	if(!info->read_port_fn)
+		digital = 0;
+
+	if(digital && (info->read_port_fn(error, info, &port) != io_ok))
+		return(io_error);
+
+	for(pin = 0; pin < info->pins; pin++)
+	{
+		if(!(*enabled & (1 << pin)))
+			continue;
+
+		if(digital & (1 << pin))
+			values[pin] = !!(port & (1 << pin));
+		else
+			if(io_read_pin(error, io, pin, &values[pin]) != io_ok)
+				return(io_error);
+	}
+
+	return(io_ok);
+}
+
+iram void io_journal_add(int io, int pin, int old_value, int new_value)
+{
+	io_journal_entry_t *entry;
+
+	if((io_journal_next - io_journal_drained) >= io_journal_size)
+	{
+		stat_io_journal_overflow++;
+		io_journal_drained++;
+	}
+
+	entry = &io_journal[io_journal_next % io_journal_size];
+
+	entry->time = system_get_time();
+	entry->io = io;
+	entry->pin = pin;
+	entry->old_value = old_value;
+	entry->new_value = new_value;
+
+	io_journal_next++;
+}
+
+irom uint32_t io_journal_sequence(void)
+{
+	return(io_journal_next);
+}
+
+// a client has seen all events before this sequence number, they're not
+// counted as lost when they're overwritten
+
+irom void io_journal_drain(uint32_t sequence)
+{
+	if(((int32_t)(sequence - io_journal_drained) > 0) && ((int32_t)(io_journal_next - sequence) >= 0))
+		io_journal_drained = sequence;
+}
+
+irom bool_t io_journal_get(uint32_t sequence, io_journal_entry_t *entry)
+{
+	if(((int32_t)(io_journal_next - sequence) <= 0) || ((io_journal_next - sequence) > io_journal_size))
+		return(false);
+
+	*entry = io_journal[sequence % io_journal_size];
+
+	return(true);
+}
+
+// send out deferred writes and wait for them, called at the end of every
+// command, a failed write stays pending and is tried again on the next flush
+
+iram io_error_t io_flush(string_t *error)
+{
+	const io_info_entry_t *info;
+	io_error_t rv;
+	int io, length;
+
+	rv = io_ok;
+
+	for(io = 0; io < io_id_size; io++)
+	{
+		info = &io_info[io];
+
+		if(!io_data[io].detected || !info->flush_fn)
+			continue;
+
+		length = error ? string_length(error) : 0;
+
+		if(error)
+			string_format(error, "flush %s: ", info->name);
+
+		if(info->flush_fn(error, info, true) != io_ok)
+		{
+			if(error)
+				string_append(error, "\n");
+
+			rv = io_error;
+		}
+		else
+			if(error)
+				string_setlength(error, length);
+	}
+
+	return(rv);
+}
+
+// the same from the periodic tick and timers, nobody waits for the result
+// there, so the i2c writes are queued, not waited for, a failed write stays
+// pending and is sent again by the next flush
+
+iram void io_flush_queue(void)
+{
+	const io_info_entry_t *info;
+	int io;
+
+	for(io = 0; io < io_id_size; io++)
+	{
+		info = &io_info[io];
+
+		if(io_data[io].detected && info->flush_fn)
+			info->flush_fn((string_t *)0, info, false);
+	}
+}
+
 irom io_error_t io_trigger_pin(string_t *error, int io, int pin, io_trigger_t trigger_type)
 {
 	const io_info_entry_t *info;
@@ -921,6 +1782,8 @@ irom io_error_t io_trigger_pin(string_t *error, int io, int pin, io_trigger_t tr
 	pin_config = &io_config[io][pin];
 	pin_data = &data->pin[pin];
 
+	io_fade_cancel(io, pin);
+
 	return(io_trigger_pin_x(error, info, pin_data, pin_config, pin, trigger_type));
 }
 
@@ -931,11 +1794,9 @@ irom io_error_t io_traits(string_t *errormsg, int io, int pin, io_pin_mode_t *pi
 	io_data_entry_t *data;
 	io_config_pin_entry_t *pin_config;
 	io_data_pin_entry_t *pin_data;
-	int pwm_period;
-	string_init(varname_pwmperiod, "pwm.period");
+	int pwm_range;
 
-	if(!config_get_int(&varname_pwmperiod, -1, -1, &pwm_period))
-		pwm_period = 65536;
+	pwm_range = io_gpio_pwm_range();
 
 	if(io >= io_id_size)
 	{
@@ -976,11 +1837,11 @@ irom io_error_t io_traits(string_t *errormsg, int io, int pin, io_pin_mode_t *pi
 			*high		= pin_config->shared.output_analog.upper_bound;
 			*step		= pin_config->speed;
 
-			if(*low > pwm_period)
+			if(*low >= pwm_range)
 				*low = 0;
 
-			if(*high > pwm_period)
-				*high = pwm_period - 1;
+			if(*high >= pwm_range)
+				*high = pwm_range - 1;
 
 			if((error = io_read_pin_x(errormsg, info, pin_data, pin_config, pin, current)) != io_ok)
 				return(error);
@@ -999,6 +1860,52 @@ irom io_error_t io_traits(string_t *errormsg, int io, int pin, io_pin_mode_t *pi
 	return(io_ok);
 }
 
+// pins that need work every tick, rebuilt whenever a pin mode changes
+
+irom static void io_worklist_rebuild(void)
+{
+	int io, pin;
+	io_worklist_t worklist;
+	io_worklist_entries_t *entries;
+
+	for(worklist = 0; worklist < io_worklist_size; worklist++)
+		io_worklist[worklist].length = 0;
+
+	for(io = 0; io < io_id_size; io++)
+	{
+		if(!io_data[io].detected)
+			continue;
+
+		for(pin = 0; pin < io_info[io].pins; pin++)
+		{
+			switch(io_config[io][pin].mode)
+			{
+				case(io_pin_trigger):
+				{
+					worklist = io_worklist_trigger;
+					break;
+				}
+
+				case(io_pin_output_analog):
+				{
+					worklist = io_worklist_output_analog;
+					break;
+				}
+
+				default:
+				{
+					continue;
+				}
+			}
+
+			entries = &io_worklist[worklist];
+			entries->entry[entries->length].io = io;
+			entries->entry[entries->length].pin = pin;
+			entries->length++;
+		}
+	}
+}
+
 irom void io_init(void)
 {
 	const io_info_entry_t *info;
@@ -1031,6 +1938,14 @@ irom void io_init(void)
 	string_init(varname_iooutputa_upper, "io.%u.%u.outputa.upper");
 	string_init(varname_i2c_pinmode, "io.%u.%u.i2c.pinmode");
 	string_init(varname_lcd_pin, "io.%u.%u.lcd.pin");
+	string_init(varname_frequency_gate, "io.%u.%u.frequency.gate");
+	string_init(varname_frequency_average, "io.%u.%u.frequency.average");
+	string_init(varname_servo_slew, "io.%u.%u.servo.slew");
+	string_init(varname_inputa_oversample, "io.%u.%u.inputa.oversample");
+
+	io_timer_heap_size = 0;
+	memset(io_timer_heap_index, io_timer_none, sizeof(io_timer_heap_index));
+	os_timer_setfn(&io_timer_short, io_timer_short_callback, (void *)0);
 
 	for(io = 0; io < io_id_size; io++)
 	{
@@ -1070,11 +1985,22 @@ irom void io_init(void)
 
 			switch(mode)
 			{
+				case(io_pin_input_analog):
+				{
+					int oversample;
+
+					if(!config_get_int(&varname_inputa_oversample, io, pin, &oversample))
+						oversample = 0;
+
+					pin_config->shared.input_analog.oversample = oversample;
+
+					break;
+				}
+
 				case(io_pin_disabled):
 				case(io_pin_error):
 				case(io_pin_input_digital):
 				case(io_pin_output_digital):
-				case(io_pin_input_analog):
 				case(io_pin_uart):
 				{
 					break;
@@ -1091,6 +2017,9 @@ irom void io_init(void)
 						continue;
 					}
 
+					if(debounce > io_counter_debounce_max)
+						debounce = io_counter_debounce_max;
+
 					pin_config->speed = debounce;
 
 					break;
@@ -1114,6 +2043,9 @@ irom void io_init(void)
 						continue;
 					}
 
+					if(debounce > io_counter_debounce_max)
+						debounce = io_counter_debounce_max;
+
 					pin_config->speed = debounce;
 
 					for(trigger = 0; trigger < max_triggers_per_pin; trigger++)
@@ -1264,6 +2196,52 @@ irom void io_init(void)
 
 					break;
 				}
+
+				case(io_pin_frequency):
+				{
+					int gate, average;
+
+					if(!info->caps.frequency)
+					{
+						pin_config->mode = io_pin_disabled;
+						pin_config->llmode = io_pin_ll_disabled;
+						continue;
+					}
+
+					if(!config_get_int(&varname_frequency_gate, io, pin, &gate))
+					{
+						pin_config->mode = io_pin_disabled;
+						pin_config->llmode = io_pin_ll_disabled;
+						continue;
+					}
+
+					if(!config_get_int(&varname_frequency_average, io, pin, &average))
+						average = 1;
+
+					pin_config->speed = gate;
+					pin_config->shared.frequency.average = average;
+
+					break;
+				}
+
+				case(io_pin_servo):
+				{
+					int slew;
+
+					if(!info->caps.servo)
+					{
+						pin_config->mode = io_pin_disabled;
+						pin_config->llmode = io_pin_ll_disabled;
+						continue;
+					}
+
+					if(!config_get_int(&varname_servo_slew, io, pin, &slew))
+						slew = 0;
+
+					pin_config->speed = slew;
+
+					break;
+				}
 			}
 		}
 
@@ -1286,6 +2264,8 @@ irom void io_init(void)
 						case(io_pin_input_analog):
 						case(io_pin_uart):
 						case(io_pin_trigger):
+						case(io_pin_frequency):
+						case(io_pin_servo):
 						case(io_pin_error):
 						{
 							break;
@@ -1321,132 +2301,92 @@ irom void io_init(void)
 							if((i2c_sda >= 0) && (i2c_scl >= 0))
 								i2c_init(i2c_sda, i2c_scl);
 
-							break;
-						}
-					}
-				}
-			}
-		}
-	}
-}
-
-iram void io_periodic(void)
-{
-	const io_info_entry_t *info;
-	io_data_entry_t *data;
-	io_config_pin_entry_t *pin_config;
-	io_data_pin_entry_t *pin_data;
-	int io, pin;
-	int trigger_status_io, trigger_status_pin;
-	io_flags_t flags = { .counter_triggered = 0 };
-	int value;
-	int trigger;
-	string_init(varname_trigger_io, "trigger.status.io");
-	string_init(varname_trigger_pin, "trigger.status.pin");
-
-	for(io = 0; io < io_id_size; io++)
-	{
-		info = &io_info[io];
-		data = &io_data[io];
-
-		if(!data->detected)
-			continue;
-
-		if(info->periodic_fn)
-			info->periodic_fn(io, info, data, &flags);
-
-		for(pin = 0; pin < info->pins; pin++)
-		{
-			pin_config = &io_config[io][pin];
-			pin_data = &data->pin[pin];
-
-			switch(pin_config->mode)
-			{
-				case(io_pin_disabled):
-				case(io_pin_input_digital):
-				case(io_pin_counter):
-				case(io_pin_output_digital):
-				case(io_pin_input_analog):
-				case(io_pin_i2c):
-				case(io_pin_uart):
-				case(io_pin_lcd):
-				case(io_pin_error):
-				{
-					break;
-				}
-
-				case(io_pin_timer):
-				{
-					if((pin_data->direction != io_dir_none) && (pin_data->speed >= 10) && ((pin_data->speed -= 10) <= 0))
-					{
-						switch(pin_data->direction)
-						{
-							case(io_dir_none):
-							{
-								break;
-							}
-
-							case(io_dir_up):
-							{
-								info->write_pin_fn((string_t *)0, info, pin_data, pin_config, pin, 1);
-								pin_data->direction = io_dir_down;
-								break;
-							}
-
-							case(io_dir_down):
-							{
-								info->write_pin_fn((string_t *)0, info, pin_data, pin_config, pin, 0);
-								pin_data->direction = io_dir_up;
-								break;
-							}
-						}
-
-						if(pin_config->flags.repeat)
-							pin_data->speed = pin_config->speed;
-						else
-						{
-							pin_data->speed = 0;
-							pin_data->direction = io_dir_none;
+							break;
 						}
 					}
-
-					break;
 				}
+			}
+		}
+	}
 
-				case(io_pin_trigger):
-				{
-					if((info->read_pin_fn((string_t *)0, info, pin_data, pin_config, pin, &value) == io_ok) && (value != 0))
-					{
-						for(trigger = 0; trigger < max_triggers_per_pin; trigger++)
-						{
-							if(pin_config->shared.trigger[trigger].action != io_trigger_none)
-							{
-								io_trigger_pin((string_t *)0,
-										pin_config->shared.trigger[trigger].io.io,
-										pin_config->shared.trigger[trigger].io.pin,
-										pin_config->shared.trigger[trigger].action);
-							}
-						}
+	io_worklist_rebuild();
+}
 
-						info->write_pin_fn((string_t *)0, info, pin_data, pin_config, pin, 0);
-					}
+iram void io_periodic(void)
+{
+	const io_info_entry_t *info;
+	io_data_entry_t *data;
+	io_config_pin_entry_t *pin_config;
+	io_data_pin_entry_t *pin_data;
+	const io_worklist_entries_t *entries;
+	unsigned int ix;
+	int io, pin;
+	int trigger_status_io, trigger_status_pin;
+	io_flags_t flags = { .counter_triggered = 0 };
+	int value;
+	int trigger;
+	uint32_t start;
+	string_init(varname_trigger_io, "trigger.status.io");
+	string_init(varname_trigger_pin, "trigger.status.pin");
 
-					break;
-				}
+	start = system_get_time();
 
-				case(io_pin_output_analog):
-				{
-					if((pin_config->shared.output_analog.upper_bound > pin_config->shared.output_analog.lower_bound) &&
-							(pin_config->speed > 0) && (pin_data->direction != io_dir_none))
-						io_trigger_pin_x((string_t *)0, info, pin_data, pin_config, pin,
-								(pin_data->direction == io_dir_up) ? io_trigger_up : io_trigger_down);
+	for(io = 0; io < io_id_size; io++)
+	{
+		info = &io_info[io];
+		data = &io_data[io];
 
-					break;
+		if(data->detected && info->periodic_fn)
+			info->periodic_fn(io, info, data, &flags);
+	}
+
+	io_timer_expire(start);
+
+	entries = &io_worklist[io_worklist_trigger];
+
+	for(ix = 0; ix < entries->length; ix++)
+	{
+		io = entries->entry[ix].io;
+		pin = entries->entry[ix].pin;
+		info = &io_info[io];
+		pin_config = &io_config[io][pin];
+		pin_data = &io_data[io].pin[pin];
+
+		if((info->read_pin_fn((string_t *)0, info, pin_data, pin_config, pin, &value) == io_ok) && (value != 0))
+		{
+			for(trigger = 0; trigger < max_triggers_per_pin; trigger++)
+			{
+				if(pin_config->shared.trigger[trigger].action != io_trigger_none)
+				{
+					io_trigger_pin((string_t *)0,
+							pin_config->shared.trigger[trigger].io.io,
+							pin_config->shared.trigger[trigger].io.pin,
+							pin_config->shared.trigger[trigger].action);
 				}
 			}
+
+			info->write_pin_fn((string_t *)0, info, pin_data, pin_config, pin, 0);
 		}
 	}
 
+	entries = &io_worklist[io_worklist_output_analog];
+
+	for(ix = 0; ix < entries->length; ix++)
+	{
+		io = entries->entry[ix].io;
+		pin = entries->entry[ix].pin;
+		info = &io_info[io];
+		pin_config = &io_config[io][pin];
+		pin_data = &io_data[io].pin[pin];
+
+		if((pin_config->shared.output_analog.upper_bound > pin_config->shared.output_analog.lower_bound) &&
+				(pin_config->speed > 0) && (pin_data->direction != io_dir_none))
+			io_trigger_pin_x((string_t *)0, info, pin_data, pin_config, pin,
+					(pin_data->direction == io_dir_up) ? io_trigger_up : io_trigger_down);
+	}
+
+	io_fade_periodic(start);
+
 	if(flags.counter_triggered &&
 			config_get_int(&varname_trigger_io, -1, -1, &trigger_status_io) &&
 			config_get_int(&varname_trigger_pin, -1, -1, &trigger_status_pin) &&
@@ -1454,6 +2394,13 @@ iram void io_periodic(void)
 	{
 		io_trigger_pin((string_t *)0, trigger_status_io, trigger_status_pin, io_trigger_on);
 	}
+
+	io_flush_queue();
+
+	stat_io_periodic_us = system_get_time() - start;
+
+	if(stat_io_periodic_us > stat_io_periodic_max_us)
+		stat_io_periodic_max_us = stat_io_periodic_us;
 }
 
 /* app commands */
@@ -1485,6 +2432,10 @@ irom app_action_t application_function_io_mode(const string_t *src, string_t *ds
 	string_init(varname_io_outputa_speed, "io.%u.%u.outputa.speed");
 	string_init(varname_io_i2c_pinmode, "io.%u.%u.i2c.pinmode");
 	string_init(varname_io_lcd_pin, "io.%u.%u.lcd.pin");
+	string_init(varname_io_frequency_gate, "io.%u.%u.frequency.gate");
+	string_init(varname_io_frequency_average, "io.%u.%u.frequency.average");
+	string_init(varname_io_servo_slew, "io.%u.%u.servo.slew");
+	string_init(varname_io_inputa_oversample, "io.%u.%u.inputa.oversample");
 
 	if(parse_int(1, src, &io, 0, ' ') != parse_ok)
 	{
@@ -1571,9 +2522,9 @@ irom app_action_t application_function_io_mode(const string_t *src, string_t *ds
 
 			int debounce;
 
-			if((parse_int(4, src, &debounce, 0, ' ') != parse_ok))
+			if((parse_int(4, src, &debounce, 0, ' ') != parse_ok) || (debounce < 0) || (debounce > io_counter_debounce_max))
 			{
-				string_append(dst, "counter: <debounce ms>\n");
+				string_format(dst, "counter: <debounce ms (0 - %u)>\n", io_counter_debounce_max);
 				return(app_action_error);
 			}
 
@@ -1599,9 +2550,9 @@ irom app_action_t application_function_io_mode(const string_t *src, string_t *ds
 				return(app_action_error);
 			}
 
-			if((parse_int(4, src, &debounce, 0, ' ') != parse_ok))
+			if((parse_int(4, src, &debounce, 0, ' ') != parse_ok) || (debounce < 0) || (debounce > io_counter_debounce_max))
 			{
-				iomode_trigger_usage(dst, "debounce");
+				iomode_trigger_usage(dst, "debounce (0 - 10000 ms)");
 				return(app_action_error);
 			}
 
@@ -1743,9 +2694,9 @@ skip:
 				return(app_action_error);
 			}
 
-			if(speed < 10)
+			if(speed < 1)
 			{
-				string_append(dst, "timer: speed too small: must be >= 10 ms\n");
+				string_append(dst, "timer: speed too small: must be >= 1 ms\n");
 				return(app_action_error);
 			}
 
@@ -1765,17 +2716,31 @@ skip:
 
 		case(io_pin_input_analog):
 		{
+			int oversample;
+
 			if(!info->caps.input_analog)
 			{
 				string_append(dst, "analog input mode invalid for this io\n");
 				return(app_action_error);
 			}
 
+			if(parse_int(4, src, &oversample, 0, ' ') != parse_ok)
+				oversample = 0;
+
+			if((oversample < 0) || (oversample > io_input_analog_oversample_max))
+			{
+				string_format(dst, "ainput: oversample must be 0-%d\n", io_input_analog_oversample_max);
+				return(app_action_error);
+			}
+
+			pin_config->shared.input_analog.oversample = oversample;
+
 			llmode = io_pin_ll_input_analog;
 
 			config_delete(&varname_io, io, pin, true);
 			config_set_int(&varname_io_mode, io, pin, mode);
 			config_set_int(&varname_io_llmode, io, pin, io_pin_ll_input_analog);
+			config_set_int(&varname_io_inputa_oversample, io, pin, oversample);
 
 			break;
 		}
@@ -1948,6 +2913,82 @@ skip:
 			break;
 		}
 
+		case(io_pin_frequency):
+		{
+			int gate, average;
+
+			if(!info->caps.frequency)
+			{
+				string_append(dst, "frequency mode invalid for this io\n");
+				return(app_action_error);
+			}
+
+			if(parse_int(4, src, &gate, 0, ' ') != parse_ok)
+			{
+				string_append(dst, "frequency: <gate time ms> [<average>]\n");
+				return(app_action_error);
+			}
+
+			if((gate < 10) || (gate > 10000))
+			{
+				string_append(dst, "frequency: gate time must be 10-10000 ms\n");
+				return(app_action_error);
+			}
+
+			if(parse_int(5, src, &average, 0, ' ') != parse_ok)
+				average = 1;
+
+			if((average < 1) || (average > 255))
+			{
+				string_append(dst, "frequency: average must be 1-255\n");
+				return(app_action_error);
+			}
+
+			pin_config->speed = gate;
+			pin_config->shared.frequency.average = average;
+
+			llmode = io_pin_ll_frequency;
+
+			config_delete(&varname_io, io, pin, true);
+			config_set_int(&varname_io_mode, io, pin, mode);
+			config_set_int(&varname_io_llmode, io, pin, io_pin_ll_frequency);
+			config_set_int(&varname_io_frequency_gate, io, pin, gate);
+			config_set_int(&varname_io_frequency_average, io, pin, average);
+
+			break;
+		}
+
+		case(io_pin_servo):
+		{
+			int slew;
+
+			if(!info->caps.servo)
+			{
+				string_append(dst, "servo mode invalid for this io\n");
+				return(app_action_error);
+			}
+
+			if(parse_int(4, src, &slew, 0, ' ') != parse_ok)
+				slew = 0;
+
+			if((slew < 0) || (slew > 2000))
+			{
+				string_append(dst, "servo: slew rate must be 0-2000 us per frame (0 = unlimited)\n");
+				return(app_action_error);
+			}
+
+			pin_config->speed = slew;
+
+			llmode = io_pin_ll_servo;
+
+			config_delete(&varname_io, io, pin, true);
+			config_set_int(&varname_io_mode, io, pin, mode);
+			config_set_int(&varname_io_llmode, io, pin, io_pin_ll_servo);
+			config_set_int(&varname_io_servo_slew, io, pin, slew);
+
+			break;
+		}
+
 		case(io_pin_disabled):
 		{
 			llmode = io_pin_ll_disabled;
@@ -1972,6 +3013,10 @@ skip:
 		return(app_action_error);
 	}
 
+	io_timer_cancel(io, pin);
+	io_fade_cancel(io, pin);
+	pin_data->direction = io_dir_none;
+
 	pin_config->mode = mode;
 	pin_config->llmode = llmode;
 
@@ -1979,9 +3024,12 @@ skip:
 	{
 		pin_config->mode = io_pin_disabled;
 		pin_config->llmode = io_pin_ll_disabled;
+		io_worklist_rebuild();
 		return(app_action_error);
 	}
 
+	io_worklist_rebuild();
+
 	io_config_dump(dst, io, pin, false);
 
 	return(app_action_normal);
@@ -2098,6 +3146,11 @@ irom app_action_t application_function_io_write(const string_t *src, string_t *d
 		return(app_action_error);
 	}
 
+	// send a deferred write now, so a failure ends up in this reply
+
+	if(io_flush(dst) != io_ok)
+		return(app_action_error);
+
 	if(io_read_pin(dst, io, pin, &value) != io_ok)
 	{
 		string_append(dst, "\n");
@@ -2109,6 +3162,207 @@ irom app_action_t application_function_io_write(const string_t *src, string_t *d
 	return(app_action_normal);
 }
 
+irom app_action_t application_function_io_write_mask(const string_t *src, string_t *dst)
+{
+	int io, mask, values;
+
+	if((parse_int(1, src, &io, 0, ' ') != parse_ok) ||
+			(parse_int(2, src, &mask, 0, ' ') != parse_ok) ||
+			(parse_int(3, src, &values, 0, ' ') != parse_ok))
+	{
+		string_append(dst, "io-write-mask <io> <mask> <values>\n");
+		return(app_action_error);
+	}
+
+	if((io < 0) || (io >= io_id_size))
+	{
+		string_format(dst, "invalid io %d\n", io);
+		return(app_action_error);
+	}
+
+	string_format(dst, "io-write-mask: io %d, mask 0x%04x, values 0x%04x: ", io, mask, values);
+
+	if(io_write_mask(dst, io, mask, values) != io_ok)
+	{
+		string_append(dst, "\n");
+		return(app_action_error);
+	}
+
+	if(io_flush(dst) != io_ok)
+		return(app_action_error);
+
+	string_append(dst, "ok\n");
+
+	return(app_action_normal);
+}
+
+irom app_action_t application_function_io_read_all(const string_t *src, string_t *dst)
+{
+	unsigned int enabled;
+	int io, pin, values[max_pins_per_io];
+
+	for(io = 0; io < io_id_size; io++)
+	{
+		if(io_read_all(dst, io, &enabled, values) != io_ok)
+		{
+			string_append(dst, "\n");
+			return(app_action_error);
+		}
+
+		if(!enabled)
+			continue;
+
+		string_format(dst, "> %d:", io);
+
+		for(pin = 0; pin < max_pins_per_io; pin++)
+			if(enabled & (1 << pin))
+				string_format(dst, " %d=%d", pin, values[pin]);
+
+		string_append(dst, "\n");
+	}
+
+	return(app_action_normal);
+}
+
+irom app_action_t application_function_io_read_binary(const string_t *src, string_t *dst)
+{
+	unsigned int enabled;
+	int io, pin, value, values[max_pins_per_io];
+	uint8_t *buffer;
+	unsigned int records;
+
+	// reply: number of records (1 byte), then per enabled pin:
+	// io (1 byte), pin (1 byte), value (4 bytes, big endian)
+
+	records = 0;
+	string_setlength(dst, 1);
+
+	for(io = 0; io < io_id_size; io++)
+	{
+		if(io_read_all((string_t *)0, io, &enabled, values) != io_ok)
+		{
+			string_clear(dst);
+			string_format(dst, "io-read-binary: io %d: read error\n", io);
+			return(app_action_error);
+		}
+
+		for(pin = 0; pin < max_pins_per_io; pin++)
+		{
+			if(!(enabled & (1 << pin)))
+				continue;
+
+			if((string_length(dst) + 6) > string_size(dst))
+				break;
+
+			value = values[pin];
+			buffer = (uint8_t *)string_buffer_nonconst(dst) + string_length(dst);
+			buffer[0] = io;
+			buffer[1] = pin;
+			buffer[2] = (value >> 24) & 0xff;
+			buffer[3] = (value >> 16) & 0xff;
+			buffer[4] = (value >>  8) & 0xff;
+			buffer[5] = (value >>  0) & 0xff;
+			string_setlength(dst, string_length(dst) + 6);
+			records++;
+		}
+	}
+
+	string_buffer_nonconst(dst)[0] = records;
+
+	return(app_action_normal);
+}
+
+irom app_action_t application_function_io_fade(const string_t *src, string_t *dst)
+{
+	io_fade_curve_t curve;
+	int io, pin, value, duration;
+	string_new(stack, curve_name, 16);
+
+	if((parse_int(1, src, &io, 0, ' ') != parse_ok) ||
+			(parse_int(2, src, &pin, 0, ' ') != parse_ok) ||
+			(parse_int(3, src, &value, 0, ' ') != parse_ok) ||
+			(parse_int(4, src, &duration, 0, ' ') != parse_ok))
+	{
+		string_append(dst, "io-fade <io> <pin> <value> <duration ms> [linear|gamma|in|out|inout]\n");
+		return(app_action_error);
+	}
+
+	if((io < 0) || (io >= io_id_size) || !io_data[io].detected)
+	{
+		string_format(dst, "invalid io %d\n", io);
+		return(app_action_error);
+	}
+
+	if((pin < 0) || (pin >= io_info[io].pins))
+	{
+		string_append(dst, "invalid pin\n");
+		return(app_action_error);
+	}
+
+	if((value < 0) || (duration < 0) || (duration > io_fade_duration_max_ms))
+	{
+		string_format(dst, "io-fade: value must be positive, duration 0-%d ms\n", io_fade_duration_max_ms);
+		return(app_action_error);
+	}
+
+	curve = io_fade_gamma;
+
+	if(parse_string(5, src, &curve_name, ' ') == parse_ok)
+	{
+		if((curve = io_fade_curve_from_string(&curve_name)) == io_fade_curve_size)
+		{
+			string_append(dst, "io-fade: curve must be linear, gamma, in, out or inout\n");
+			return(app_action_error);
+		}
+	}
+
+	string_format(dst, "io-fade: io %d, pin %d, value %d, duration %d ms, curve %s: ",
+			io, pin, value, duration, io_fade_curve_names[curve]);
+
+	if(io_fade_start(dst, io, pin, value, duration, curve) != io_ok)
+		return(app_action_error);
+
+	string_append(dst, "ok\n");
+
+	return(app_action_normal);
+}
+
+irom app_action_t application_function_io_journal(const string_t *src, string_t *dst)
+{
+	const io_journal_entry_t *entry;
+	unsigned int cursor, oldest;
+
+	// without cursor, show all events still in the journal
+
+	oldest = (io_journal_next > io_journal_size) ? (io_journal_next - io_journal_size) : 0;
+
+	if(parse_int(1, src, (int *)&cursor, 0, ' ') != parse_ok)
+		cursor = oldest;
+
+	if((int32_t)(cursor - oldest) < 0)
+	{
+		string_format(dst, "> events lost: %u\n", oldest - cursor);
+		cursor = oldest;
+	}
+
+	for(; (int32_t)(cursor - io_journal_next) < 0; cursor++)
+	{
+		if((string_length(dst) + 64) > string_size(dst))
+			break;
+
+		entry = &io_journal[cursor % io_journal_size];
+
+		string_format(dst, "> %u: %u us, io %u, pin %u: %d -> %d\n",
+				cursor, entry->time, entry->io, entry->pin, entry->old_value, entry->new_value);
+	}
+
+	io_journal_drain(cursor);
+
+	string_format(dst, "> next cursor: %u\n", cursor);
+
+	return(app_action_normal);
+}
+
 irom app_action_t application_function_io_trigger(const string_t *src, string_t *dst)
 {
 	const io_info_entry_t *info;
@@ -2169,6 +3423,9 @@ irom app_action_t application_function_io_trigger(const string_t *src, string_t
 		return(app_action_error);
 	}
 
+	if(io_flush(dst) != io_ok)
+		return(app_action_error);
+
 	string_append(dst, "ok\n");
 
 	return(app_action_normal);
@@ -2287,6 +3544,8 @@ typedef enum
 	ds_id_i2c_scl,
 	ds_id_uart,
 	ds_id_lcd,
+	ds_id_frequency,
+	ds_id_servo,
 	ds_id_unknown,
 	ds_id_not_detected,
 	ds_id_info_1,
@@ -2333,6 +3592,8 @@ static const roflash dump_string_t roflash_dump_strings =
 		"scl",
 		"uart",
 		"lcd",
+		"frequency: %d Hz, gate: %d ms, average: %d",
+		"servo, position: %d us, slew: %d us/frame",
 		"unknown",
 		"  not found\n",
 		", info: ",
@@ -2367,6 +3628,8 @@ static const roflash dump_string_t roflash_dump_strings =
 		"<td>scl</td>",
 		"<td>uart</td>",
 		"<td>lcd</td>",
+		"<td>frequency: %d Hz, gate: %d ms, average: %d</td>",
+		"<td>servo, position: %d us, slew: %d us/frame</td>",
 		"<td>unknown</td>",
 		"<tr><td colspan=\"6\">not connected</td></tr>\n",
 		"<td>",
@@ -2517,7 +3780,7 @@ irom void io_config_dump(string_t *dst, int io_id, int pin_id, bool html)
 								pin_config->direction == io_dir_up ? "up" : (pin_config->direction == io_dir_down ? "down" : "none"),
 								pin_config->speed,
 								pin_data->direction == io_dir_up ? "up" : (pin_data->direction == io_dir_down ? "down" : "none"),
-								pin_data->speed,
+								io_timer_remaining_ms(io, pin),
 								onoff(value));
 					else
 						string_append_cstr_flash(dst, (*roflash_strings)[ds_id_error]);
@@ -2566,6 +3829,27 @@ irom void io_config_dump(string_t *dst, int io_id, int pin_id, bool html)
 					break;
 				}
 
+				case(io_pin_frequency):
+				{
+					if(error == io_ok)
+						string_format_flash_ptr(dst, (*roflash_strings)[ds_id_frequency], value,
+								pin_config->speed, pin_config->shared.frequency.average);
+					else
+						string_append_cstr_flash(dst, (*roflash_strings)[ds_id_error]);
+
+					break;
+				}
+
+				case(io_pin_servo):
+				{
+					if(error == io_ok)
+						string_format_flash_ptr(dst, (*roflash_strings)[ds_id_servo], value, pin_config->speed);
+					else
+						string_append_cstr_flash(dst, (*roflash_strings)[ds_id_error]);
+
+					break;
+				}
+
 				default:
 				{
 					string_append_cstr_flash(dst, (*roflash_strings)[ds_id_unknown]);
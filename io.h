@@ -16,7 +16,9 @@ typedef enum
 enum
 {
 	max_pins_per_io = 16,
-	max_triggers_per_pin = 2
+	max_triggers_per_pin = 2,
+	io_input_analog_oversample_max = 3,
+	io_counter_debounce_max = 10000,
 };
 
 enum
@@ -75,6 +77,8 @@ typedef enum attr_packed
 	io_pin_uart,
 	io_pin_lcd,
 	io_pin_trigger,
+	io_pin_frequency,
+	io_pin_servo,
 	io_pin_error,
 	io_pin_size = io_pin_error,
 } io_pin_mode_t;
@@ -119,6 +123,8 @@ typedef enum attr_packed
 	io_pin_ll_output_analog,
 	io_pin_ll_i2c,
 	io_pin_ll_uart,
+	io_pin_ll_frequency,
+	io_pin_ll_servo,
 	io_pin_ll_error,
 	io_pin_ll_size = io_pin_ll_error
 } io_pin_ll_mode_t;
@@ -155,6 +161,8 @@ typedef struct
 	unsigned int i2c:1;
 	unsigned int uart:1;
 	unsigned int pullup:1;
+	unsigned int frequency:1;
+	unsigned int servo:1;
 } io_caps_t;
 
 assert_size(io_caps_t, 4);
@@ -208,6 +216,16 @@ typedef struct
 			io_lcd_mode_t	pin_use;
 		} lcd;
 
+		struct
+		{
+			uint8_t			average;
+		} frequency;
+
+		struct
+		{
+			uint8_t			oversample;
+		} input_analog;
+
 		struct
 		{
 			config_io_t		io;
@@ -216,6 +234,25 @@ typedef struct
 	} shared;
 } io_config_pin_entry_t;
 
+typedef struct
+{
+	unsigned int	edges;
+	uint32_t		first;
+	uint32_t		last;
+	uint32_t		period;
+	uint32_t		average;
+	uint32_t		gate_start;
+} io_frequency_t;
+
+typedef struct
+{
+	uint32_t	time;
+	uint8_t		io;
+	uint8_t		pin;
+	int			old_value;
+	int			new_value;
+} io_journal_entry_t;
+
 typedef const struct io_info_entry_T
 {
 	uint8_t address;
@@ -229,6 +266,9 @@ typedef const struct io_info_entry_T
 	io_error_t	(* const get_pin_info_fn)	(string_t *error,	const struct io_info_entry_T *, io_data_pin_entry_t *, const io_config_pin_entry_t *, int);
 	io_error_t	(* const read_pin_fn)		(string_t *error,	const struct io_info_entry_T *, io_data_pin_entry_t *, const io_config_pin_entry_t *, int, int *);
 	io_error_t	(* const write_pin_fn)		(string_t *error,	const struct io_info_entry_T *, io_data_pin_entry_t *, const io_config_pin_entry_t *, int, int);
+	io_error_t	(* const write_mask_fn)		(string_t *error,	const struct io_info_entry_T *, unsigned int mask, unsigned int values);
+	io_error_t	(* const read_port_fn)		(string_t *error,	const struct io_info_entry_T *, unsigned int *values);
+	io_error_t	(* const flush_fn)			(string_t *error,	const struct io_info_entry_T *, bool_t wait);
 } io_info_entry_t;
 
 typedef const io_info_entry_t io_info_t[io_id_size];
@@ -241,14 +281,43 @@ void		io_init(void);
 void		io_periodic(void);
 io_error_t	io_read_pin(string_t *, int, int, int *);
 io_error_t	io_write_pin(string_t *, int, int, int);
+io_error_t	io_write_mask(string_t *, int io, unsigned int mask, unsigned int values);
+io_error_t	io_flush(string_t *);
+void		io_flush_queue(void);
+void		io_journal_add(int io, int pin, int old_value, int new_value);
+uint32_t	io_journal_sequence(void);
+void		io_journal_drain(uint32_t sequence);
+bool_t		io_journal_get(uint32_t sequence, io_journal_entry_t *entry);
 io_error_t	io_trigger_pin(string_t *, int, int, io_trigger_t);
 io_error_t	io_traits(string_t *, int io, int pin, io_pin_mode_t *mode, int *low, int *high, int *step, int *current);
 void		io_config_dump(string_t *dst, int io_id, int pin_id, bool html);
 void		io_string_from_ll_mode(string_t *, io_pin_ll_mode_t, int pad);
+void		io_frequency_init(io_frequency_t *);
+void		io_frequency_gate(io_frequency_t *, const io_config_pin_entry_t *, uint32_t now);
+unsigned int io_frequency_value(const io_frequency_t *);
+void		io_frequency_info(string_t *, const io_frequency_t *);
+
+// called from interrupt handler, timestamps are in cpu cycles (ccount)
+
+always_inline static void io_frequency_edge(io_frequency_t *frequency, uint32_t now)
+{
+	if(frequency->edges == 0)
+		frequency->first = now;
+	else
+		frequency->period = now - frequency->last;
+
+	frequency->last = now;
+	frequency->edges++;
+}
 
 app_action_t application_function_io_mode(const string_t *src, string_t *dst);
 app_action_t application_function_io_read(const string_t *src, string_t *dst);
 app_action_t application_function_io_write(const string_t *src, string_t *dst);
+app_action_t application_function_io_write_mask(const string_t *src, string_t *dst);
+app_action_t application_function_io_read_all(const string_t *src, string_t *dst);
+app_action_t application_function_io_read_binary(const string_t *src, string_t *dst);
+app_action_t application_function_io_fade(const string_t *src, string_t *dst);
+app_action_t application_function_io_journal(const string_t *src, string_t *dst);
 app_action_t application_function_io_trigger(const string_t *src, string_t *dst);
 app_action_t application_function_io_set_flag(const string_t *src, string_t *dst);
 app_action_t application_function_io_clear_flag(const string_t *src, string_t *dst);
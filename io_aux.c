@@ -15,10 +15,85 @@ typedef union
 		unsigned int debounce;
 		unsigned int last_value;
 	} counter;
+
+	struct
+	{
+		io_frequency_t frequency;
+		unsigned int last_value;
+	} frequency;
 } io_aux_data_pin_t;
 
 static io_aux_data_pin_t aux_pin_data[io_aux_pin_size];
 
+// adc capture, samples are taken from an os timer, system_adc_read can't
+// be called from interrupt context so frc1 can't be used for it
+
+enum
+{
+	adc_capture_buffer_size = 512,
+	adc_capture_chunk_size = 256,
+};
+
+typedef struct
+{
+	unsigned int	active:1;
+	unsigned int	interval_ms;
+	unsigned int	oversample;
+	unsigned int	wanted;
+	unsigned int	samples;
+	unsigned int	missed;
+	uint32_t		first;
+	uint32_t		previous;
+} adc_capture_t;
+
+static adc_capture_t adc_capture;
+static uint16_t adc_capture_buffer[adc_capture_buffer_size];
+static os_timer_t adc_capture_timer;
+
+irom static unsigned int adc_sample(unsigned int oversample)
+{
+	unsigned int conversions, sum;
+
+	// sum 4^n conversions and decimate by 2^n, this yields n extra bits
+	// of resolution, then scale to 16 bits like a single conversion
+
+	sum = 0;
+
+	for(conversions = 1 << (oversample * 2); conversions > 0; conversions--)
+		sum += system_adc_read();
+
+	return((sum >> oversample) << (6 - oversample));
+}
+
+irom static void adc_capture_callback(void *arg)
+{
+	uint32_t now, elapsed, interval_us;
+
+	now = system_get_time();
+	interval_us = adc_capture.interval_ms * 1000;
+
+	// a late timer callback means one or more samples were missed
+
+	if(adc_capture.samples == 0)
+		adc_capture.first = now;
+	else
+	{
+		elapsed = now - adc_capture.previous;
+
+		if(elapsed >= (interval_us + (interval_us / 2)))
+			adc_capture.missed += ((elapsed + (interval_us / 2)) / interval_us) - 1;
+	}
+
+	adc_capture.previous = now;
+	adc_capture_buffer[adc_capture.samples++] = adc_sample(adc_capture.oversample);
+
+	if(adc_capture.samples >= adc_capture.wanted)
+	{
+		os_timer_disarm(&adc_capture_timer);
+		adc_capture.active = 0;
+	}
+}
+
 irom attr_const io_error_t io_aux_init(const struct io_info_entry_T *info)
 {
 	int pin;
@@ -64,12 +139,44 @@ iram void io_aux_periodic(int io, const struct io_info_entry_T *info, io_data_en
 
 					if(!pin_value)
 					{
+						io_journal_add(io, pin, io_aux_data_pin->counter.counter, io_aux_data_pin->counter.counter + 1);
 						io_aux_data_pin->counter.counter++;
 						flags->counter_triggered = 1;
 					}
 				}
 			}
 		}
+
+		if(pin_config->llmode == io_pin_ll_input_digital)
+		{
+			io_aux_data_pin_t *io_aux_data_pin = &aux_pin_data[pin];
+			unsigned int pin_value = !!(read_peri_reg(RTC_GPIO_IN_DATA) & 0x01);
+
+			if(pin_value != io_aux_data_pin->counter.last_value)
+			{
+				io_journal_add(io, pin, io_aux_data_pin->counter.last_value, pin_value);
+				io_aux_data_pin->counter.last_value = pin_value;
+			}
+		}
+
+		if(pin_config->llmode == io_pin_ll_frequency)
+		{
+			io_aux_data_pin_t *io_aux_data_pin = &aux_pin_data[pin];
+			unsigned int pin_value = !!(read_peri_reg(RTC_GPIO_IN_DATA) & 0x01);
+			uint32_t now = read_ccount();
+
+			// the rtc gpio can't interrupt, edges are sampled every tick (10 ms)
+
+			if(pin_value != io_aux_data_pin->frequency.last_value)
+			{
+				io_aux_data_pin->frequency.last_value = pin_value;
+
+				if(!pin_value)
+					io_frequency_edge(&io_aux_data_pin->frequency.frequency, now);
+			}
+
+			io_frequency_gate(&io_aux_data_pin->frequency.frequency, pin_config, now);
+		}
 	}
 }
 
@@ -93,6 +200,20 @@ irom io_error_t io_aux_init_pin_mode(string_t *error_message, const struct io_in
 					clear_set_peri_reg_mask(RTC_GPIO_CONF, 0x01, 0x00);
 					clear_set_peri_reg_mask(RTC_GPIO_ENABLE, 0x01, 0x00);
 
+					aux_pin_data[pin].counter.last_value = !!(read_peri_reg(RTC_GPIO_IN_DATA) & 0x01);
+
+					break;
+				}
+
+				case(io_pin_ll_frequency):
+				{
+					clear_set_peri_reg_mask(PAD_XPD_DCDC_CONF, 0x43, 0x01);
+					clear_set_peri_reg_mask(RTC_GPIO_CONF, 0x01, 0x00);
+					clear_set_peri_reg_mask(RTC_GPIO_ENABLE, 0x01, 0x00);
+
+					io_frequency_init(&aux_pin_data[pin].frequency.frequency);
+					aux_pin_data[pin].frequency.last_value = !!(read_peri_reg(RTC_GPIO_IN_DATA) & 0x01);
+
 					break;
 				}
 
@@ -187,6 +308,19 @@ irom io_error_t io_aux_get_pin_info(string_t *dst, const struct io_info_entry_T
 			break;
 		}
 
+		case(io_pin_ll_frequency):
+		{
+			string_append(dst, ", ");
+			io_frequency_info(dst, &aux_pin_data[pin].frequency.frequency);
+			break;
+		}
+
+		case(io_pin_ll_input_analog):
+		{
+			string_format(dst, ", oversample: %u conversions", 1U << (pin_config->shared.input_analog.oversample * 2));
+			break;
+		}
+
 		default:
 		{
 			break;
@@ -218,6 +352,12 @@ irom io_error_t io_aux_read_pin(string_t *error_message, const struct io_info_en
 					break;
 				}
 
+				case(io_pin_ll_frequency):
+				{
+					*value = io_frequency_value(&aux_pin_data[pin].frequency.frequency);
+					break;
+				}
+
 				default:
 				{
 					if(error_message)
@@ -236,7 +376,7 @@ irom io_error_t io_aux_read_pin(string_t *error_message, const struct io_info_en
 			{
 				case(io_pin_ll_input_analog):
 				{
-					*value = system_adc_read() << 6;
+					*value = adc_sample(pin_config->shared.input_analog.oversample);
 
 					break;
 				}
@@ -343,3 +483,105 @@ irom io_error_t io_aux_write_pin(string_t *error_message, const struct io_info_e
 
 	return(io_ok);
 }
+
+irom app_action_t application_function_adc_capture(const string_t *src, string_t *dst)
+{
+	int interval, samples;
+	unsigned int rate;
+
+	if(parse_int(1, src, &interval, 0, ' ') == parse_ok)
+	{
+		if((interval < 1) || (interval > 1000))
+		{
+			string_append(dst, "adc-capture: interval must be 1-1000 ms\n");
+			return(app_action_error);
+		}
+
+		if(parse_int(2, src, &samples, 0, ' ') != parse_ok)
+			samples = adc_capture_buffer_size;
+
+		if((samples < 2) || (samples > adc_capture_buffer_size))
+		{
+			string_format(dst, "adc-capture: samples must be 2-%d\n", adc_capture_buffer_size);
+			return(app_action_error);
+		}
+
+		if(io_config[io_id_aux][io_aux_pin_adc].llmode != io_pin_ll_input_analog)
+		{
+			string_append(dst, "adc-capture: adc pin not in analog input mode\n");
+			return(app_action_error);
+		}
+
+		os_timer_disarm(&adc_capture_timer);
+
+		adc_capture.active = 1;
+		adc_capture.interval_ms = interval;
+		adc_capture.oversample = io_config[io_id_aux][io_aux_pin_adc].shared.input_analog.oversample;
+		adc_capture.wanted = samples;
+		adc_capture.samples = 0;
+		adc_capture.missed = 0;
+
+		os_timer_setfn(&adc_capture_timer, adc_capture_callback, (void *)0);
+		os_timer_arm(&adc_capture_timer, interval, 1);
+	}
+
+	// achieved rate is in mHz, from the first to the last sample taken
+
+	if((adc_capture.samples > 1) && (adc_capture.previous != adc_capture.first))
+		rate = (uint64_t)(adc_capture.samples - 1) * 1000000000 / (adc_capture.previous - adc_capture.first);
+	else
+		rate = 0;
+
+	string_format(dst, "adc-capture: %s, interval: %u ms, samples: %u/%u, rate: %u.%03u Hz, missed: %u\n",
+			adc_capture.active ? "running" : "stopped",
+			adc_capture.interval_ms, adc_capture.samples, adc_capture.wanted,
+			rate / 1000, rate % 1000, adc_capture.missed);
+
+	return(app_action_normal);
+}
+
+irom app_action_t application_function_adc_capture_read(const string_t *src, string_t *dst)
+{
+	int offset, count, ix;
+	uint8_t *buffer;
+
+	if(parse_int(1, src, &offset, 0, ' ') != parse_ok)
+	{
+		string_append(dst, "adc-capture-read <offset>\n");
+		return(app_action_error);
+	}
+
+	if((offset < 0) || ((unsigned int)offset > adc_capture.samples))
+	{
+		string_format(dst, "adc-capture-read: offset must be 0-%u\n", adc_capture.samples);
+		return(app_action_error);
+	}
+
+	// reply: offset and sample count (2 bytes each), then the samples,
+	// 2 bytes each, all big endian
+
+	count = adc_capture.samples - offset;
+
+	if(count > adc_capture_chunk_size)
+		count = adc_capture_chunk_size;
+
+	if((4 + (count * 2)) > string_size(dst))
+		count = (string_size(dst) - 4) / 2;
+
+	buffer = (uint8_t *)string_buffer_nonconst(dst);
+
+	buffer[0] = (offset >> 8) & 0xff;
+	buffer[1] = (offset >> 0) & 0xff;
+	buffer[2] = (count >> 8) & 0xff;
+	buffer[3] = (count >> 0) & 0xff;
+
+	for(ix = 0; ix < count; ix++)
+	{
+		buffer[4 + (ix * 2) + 0] = (adc_capture_buffer[offset + ix] >> 8) & 0xff;
+		buffer[4 + (ix * 2) + 1] = (adc_capture_buffer[offset + ix] >> 0) & 0xff;
+	}
+
+	string_setlength(dst, 4 + (count * 2));
+
+	return(app_action_normal);
+}
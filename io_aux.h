@@ -23,4 +23,7 @@ io_error_t	io_aux_get_pin_info(string_t *, const struct io_info_entry_T *, io_da
 io_error_t	io_aux_read_pin(string_t *, const struct io_info_entry_T *, io_data_pin_entry_t *, const io_config_pin_entry_t *, int, int *);
 io_error_t	io_aux_write_pin(string_t *, const struct io_info_entry_T *, io_data_pin_entry_t *, const io_config_pin_entry_t *, int, int);
 
+app_action_t application_function_adc_capture(const string_t *src, string_t *dst);
+app_action_t application_function_adc_capture_read(const string_t *src, string_t *dst);
+
 #endif
@@ -1,6 +1,7 @@
 #include "io_gpio.h"
 
 #include "stats.h"
+#include "pwm.h"
 #include "util.h"
 
 #include <user_interface.h>
@@ -55,8 +56,14 @@ enum
 
 enum
 {
-	io_gpio_pin_size = 16,
-	io_gpio_pwm_max_channels = 4,
+	io_gpio_pin_size = pwm_max_channels,
+	io_gpio_pwm_phase_sets = 3,
+	io_gpio_servo_max_channels = 8,
+	io_gpio_servo_ticks_per_us = 5,
+	io_gpio_servo_frame_ticks = 20000 * io_gpio_servo_ticks_per_us,
+	io_gpio_servo_min_us = 500,
+	io_gpio_servo_max_us = 2500,
+	io_gpio_servo_lead_ticks = 10,
 };
 
 typedef enum
@@ -80,19 +87,31 @@ typedef union
 	struct
 	{
 		unsigned int counter;
-		unsigned int debounce;
+		unsigned int harvested;
+		uint32_t debounce;		// us
+		uint32_t last;			// us
 	} counter;
 
+	io_frequency_t frequency;
+
 	struct
 	{
-		int this;
-		int next;
 		unsigned int duty;
 	} pwm;
+
+	struct
+	{
+		unsigned int target;	// timer ticks, 0 = no pulses
+		unsigned int position;	// timer ticks, follows target at the slew rate, updated by the isr
+	} servo;
 } gpio_data_pin_t;
 
 static gpio_data_pin_t gpio_data[io_gpio_pin_size];
 
+static uint32_t gpio_input_last = 0;
+static uint32_t gpio_edge_mask = 0;
+static volatile uint32_t gpio_edge_flags = 0;
+
 static gpio_info_t gpio_info_table[io_gpio_pin_size] =
 {
 	{ true, 	PERIPHS_IO_MUX_GPIO0_U,		FUNC_GPIO0,		io_uart_none,	-1			},
@@ -208,22 +227,101 @@ irom static bool_t gpio_func_select(int pin, int func)
 	return(true);
 }
 
-// PWM
+// counter and frequency
 
-typedef struct
+iram static void gpio_isr(void *arg)
 {
-	int			duty;
-	int			delay;
-	uint16_t	mask;
-} pwm_phase_t;
+	uint32_t status, now, now_us;
+	int pin;
+	gpio_data_pin_t *gpio_pin_data;
 
-typedef struct
+	now = read_ccount();
+
+	status = gpio_reg_read(GPIO_STATUS_ADDRESS);
+	gpio_reg_write(GPIO_STATUS_W1TC_ADDRESS, status);
+
+	stat_gpio_interrupts++;
+
+	gpio_edge_flags |= status & gpio_edge_mask;
+
+	for(pin = 0; (pin < io_gpio_pin_size) && (status != 0); pin++, status >>= 1)
+	{
+		if(!(status & 0x01))
+			continue;
+
+		gpio_pin_data = &gpio_data[pin];
+
+		switch(io_config[io_id_gpio][pin].llmode)
+		{
+			case(io_pin_ll_counter):
+			{
+				// ccount wraps too quickly (~27 s at 160 MHz) for long debounce
+				// delays after a long idle period, use the microsecond timer
+
+				now_us = system_get_time();
+
+				if((now_us - gpio_pin_data->counter.last) >= gpio_pin_data->counter.debounce)
+				{
+					gpio_pin_data->counter.counter++;
+					gpio_pin_data->counter.last = now_us;
+				}
+
+				break;
+			}
+
+			case(io_pin_ll_frequency):
+			{
+				io_frequency_edge(&gpio_pin_data->frequency, now);
+
+				break;
+			}
+
+			default:
+			{
+				break;
+			}
+		}
+	}
+}
+
+// edge detect for other drivers, e.g. an interrupt output of an i2c expander
+
+irom bool_t io_gpio_edge_detect(int pin)
 {
-	unsigned int	size;
-	uint32_t		init_set_mask;
-	uint32_t		init_clear_mask;
-	pwm_phase_t		phase[io_gpio_pwm_max_channels + 1];
-} pwm_phases_t;
+	if((pin < 0) || (pin >= io_gpio_pin_size) || !gpio_info_table[pin].valid)
+		return(false);
+
+	if(io_config[io_id_gpio][pin].llmode != io_pin_ll_input_digital)
+		return(false);
+
+	ETS_GPIO_INTR_DISABLE();
+
+	gpio_edge_mask |= 1 << pin;
+	gpio_edge_flags |= 1 << pin;
+
+	gpio_reg_write(GPIO_STATUS_W1TC_ADDRESS, 1 << pin);
+	gpio_pin_intr_state_set(pin, GPIO_PIN_INTR_POSEDGE);
+
+	ETS_GPIO_INTR_ENABLE();
+
+	return(true);
+}
+
+iram bool_t io_gpio_edge_pending(int pin)
+{
+	bool_t pending;
+
+	ETS_GPIO_INTR_DISABLE();
+
+	pending = !!(gpio_edge_flags & (1 << pin));
+	gpio_edge_flags &= ~(1 << pin);
+
+	ETS_GPIO_INTR_ENABLE();
+
+	return(pending);
+}
+
+// PWM
 
 typedef struct
 {
@@ -231,13 +329,33 @@ typedef struct
 	unsigned int	pwm_next_phase_set:1;
 	unsigned int	pwm_cpu_high_speed:1;
 	unsigned int	pwm_int_enabled:1;
+	unsigned int	pwm_dirty:1;
+	unsigned int	pwm_edge_expected:1;
+	unsigned int	pwm_running:1;
+	unsigned int	servo_running:1;
+	unsigned int	servo_next_channel_set:1;
 } io_gpio_flags_t;
 
+typedef struct
+{
+	unsigned int	size;
+	uint8_t			pin[io_gpio_servo_max_channels];
+} servo_channels_t;
+
 static unsigned int		pwm_current_phase_set;
-static pwm_phases_t		pwm_phase[2];
+static unsigned int		pwm_pending_phase_set;	// taken over by the isr at the start of the next period
+static pwm_phases_t		pwm_phase[io_gpio_pwm_phase_sets];
 static io_gpio_flags_t	io_gpio_flags;
-
-static int pwm_head;
+static uint32_t			pwm_isr_max_cycles[pwm_max_phases + 1];	// by number of phases
+static pwm_channels_t	pwm_channels;	// channels sorted by duty, as of the last pwm_go
+static uint32_t			pwm_due;		// cpu cycles
+static unsigned int		servo_current_channel_set;
+static servo_channels_t	servo_channel[2];
+static uint32_t			servo_pin_mask;
+static uint32_t			servo_due;		// cpu cycles
+static io_gpio_timer_client_t	timer_client;
+static volatile bool_t	timer_client_running;
+static uint32_t			timer_client_due;	// cpu cycles
 
 static void pwm_isr(void);
 
@@ -278,22 +396,84 @@ iram always_inline static uint32_t pwm_timer_get(void)
 	return(read_peri_reg(FRC1_COUNT_REG));
 }
 
-iram static void pwm_isr(void)
+// histogram bucket for a number of cpu cycles, log2 scale
+
+iram always_inline static unsigned int pwm_histogram_bucket(uint32_t cycles)
 {
-	static unsigned int	phase, delay;
-	static pwm_phases_t *phase_data;
+	unsigned int bucket;
 
-	set_peri_reg_mask(FRC1_INT_REG, FRC1_INT_CLEAR);
+	for(bucket = 0, cycles >>= stat_pwm_histogram_shift; (cycles > 0) && (bucket < (stat_pwm_histogram_size - 1)); cycles >>= 1)
+		bucket++;
 
-	stat_pwm_timer_interrupts++;
+	return(bucket);
+}
 
-	if(!pwm_isr_enabled())
+iram always_inline static void pwm_isr_account(uint32_t start, unsigned int phases)
+{
+	uint32_t cycles = read_ccount() - start;
+
+	stat_pwm_isr_cycles += cycles;
+	stat_pwm_isr_histogram[pwm_histogram_bucket(cycles)]++;
+
+	if(cycles > pwm_isr_max_cycles[phases])
+		pwm_isr_max_cycles[phases] = cycles;
+}
+
+// edge jitter, the difference between the time an edge was programmed
+// for (previous edge + delay) and the time the gpio is actually updated
+
+iram always_inline static void pwm_isr_edge(unsigned int delay)
+{
+	static uint32_t expected;
+	uint32_t now;
+	int32_t jitter;
+
+	now = read_ccount();
+
+	if(io_gpio_flags.pwm_edge_expected)
 	{
-		stat_pwm_timer_interrupts_while_nmi_masked++;
-		return;
+		jitter = now - expected;
+
+		if(jitter < 0)
+			jitter = 0 - jitter;
+
+		stat_pwm_jitter_histogram[pwm_histogram_bucket(jitter)]++;
 	}
 
-	phase_data = &pwm_phase[pwm_current_phase_set & 0x01];
+	// timer runs at 5 MHz (apb / 16)
+
+	expected = now + (delay * (io_gpio_flags.pwm_cpu_high_speed ? 32 : 16));
+	io_gpio_flags.pwm_edge_expected = 1;
+}
+
+// temporal dithering, the fraction of the duty below one timer tick is
+// spread over a cycle of frames (periods), in some frames the edge of a
+// phase is one tick later, which also shortens the delay after it
+
+iram always_inline static unsigned int pwm_dither_delay(const pwm_phases_t *phase_data, unsigned int phase, unsigned int frame)
+{
+	unsigned int delay = phase_data->phase[phase].delay;
+
+	if(phase_data->phase[phase].dither & (1 << frame))
+		delay--;
+
+	if(((phase + 1) < phase_data->size) && (phase_data->phase[phase + 1].dither & (1 << frame)))
+		delay++;
+
+	return(delay);
+}
+
+// run the pwm phases that are due, returns the delay to the next phase
+// in timer ticks, or 0 when the pwm has stopped
+
+iram static unsigned int pwm_isr_phases(uint32_t start)
+{
+	static unsigned int	phase, frame;
+	static pwm_phases_t *phase_data;
+	unsigned int delay;
+	uint32_t busy_wait_start;
+
+	phase_data = &pwm_phase[pwm_current_phase_set];
 
 	for(;;)
 	{
@@ -303,7 +483,7 @@ iram static void pwm_isr(void)
 		if(phase == 0)
 		{
 			if(io_gpio_flags.pwm_next_phase_set)
-				pwm_current_phase_set = (pwm_current_phase_set + 1) & 0x01;
+				pwm_current_phase_set = pwm_pending_phase_set;
 
 			if(io_gpio_flags.pwm_reset_phase_set || io_gpio_flags.pwm_next_phase_set)
 			{
@@ -316,16 +496,22 @@ iram static void pwm_isr(void)
 
 			if(phase_data->size < 2)
 			{
-				pwm_isr_enable(false);
-				return;
+				pwm_isr_account(start, phase_data->size);
+				return(0);
 			}
 
-			gpio_set_mask(phase_data->phase[phase].mask);
+			frame = (frame + 1) & (pwm_dither_frames - 1);
 		}
+
+		gpio_set_mask(phase_data->phase[phase].set_mask);
+		gpio_clear_mask(phase_data->phase[phase].clear_mask);
+
+		if(phase_data->dither)
+			delay = pwm_dither_delay(phase_data, phase, frame);
 		else
-			gpio_clear_mask(phase_data->phase[phase].mask);
+			delay = phase_data->phase[phase].delay;
 
-		delay = phase_data->phase[phase].delay;
+		pwm_isr_edge(delay);
 
 		phase++;
 
@@ -333,12 +519,18 @@ iram static void pwm_isr(void)
 			continue;
 		else
 			if(delay < 24)
+			{
+				busy_wait_start = read_ccount();
+
 				if(io_gpio_flags.pwm_cpu_high_speed)
 					for(delay = ((delay - 2) * 6) + 5; delay > 0; delay--)
 						asm volatile("nop");
 				else
 					for(delay = ((delay - 2) * 3) + 2; delay > 0; delay--)
 						asm volatile("nop");
+
+				stat_pwm_busy_wait_cycles += read_ccount() - busy_wait_start;
+			}
 			else
 			{
 				if(io_gpio_flags.pwm_cpu_high_speed)
@@ -346,264 +538,497 @@ iram static void pwm_isr(void)
 				else
 					delay -= 14;
 
-				pwm_timer_set(delay);
+				pwm_isr_account(start, phase_data->size);
 
-				return;
+				return(delay);
 			}
 	}
 }
 
-irom static void pwm_go(void)
+// servo, the channels get their pulse one after another within the 20 ms
+// frame, the falling edge of one channel is the rising edge of the next,
+// returns the delay to the next edge in timer ticks, or 0 when there are
+// no servo channels left
+
+iram static unsigned int servo_isr_edge(void)
 {
-	io_config_pin_entry_t *pin1_config;
-	gpio_info_t *pin1_info;
-	gpio_data_pin_t *pin1_data, *pin2_data, *pin3_data;
-	int pin1, pin2, pin3;
-	pwm_phases_t *phase_data;
-	unsigned int duty, delta, new_phase_set, pwm_period;
-	uint32_t timer_value;
-	bool_t isr_enabled;
-	string_init(varname_pwmperiod, "pwm.period");
+	static unsigned int slot, used;
+	const servo_channels_t *channels;
+	gpio_data_pin_t *servo_data;
+	unsigned int position, target, slew;
+	int pin;
 
-	if(!config_get_int(&varname_pwmperiod, -1, -1, &pwm_period))
-		pwm_period = 65536;
+	if(slot == 0)
+	{
+		if(io_gpio_flags.servo_next_channel_set)
+		{
+			servo_current_channel_set = (servo_current_channel_set + 1) & 0x01;
+			io_gpio_flags.servo_next_channel_set = 0;
+		}
 
-	isr_enabled = pwm_isr_enabled();
-	pwm_isr_enable(false);
-	timer_value = pwm_timer_get();
+		used = 0;
+	}
 
-	if(timer_value < 32)
-		timer_value = 32;
+	channels = &servo_channel[servo_current_channel_set];
 
-	if(timer_value > pwm_period)
-		timer_value = pwm_period;
+	if(slot > 0)
+	{
+		pin = channels->pin[slot - 1];
 
-	// if next set is already active or ISR is off, suspend ISR and re-configure current set
+		if(io_config[io_id_gpio][pin].llmode == io_pin_ll_servo)
+			gpio_clear_mask(1 << pin);
+	}
 
-	if(io_gpio_flags.pwm_next_phase_set || !isr_enabled)
-		new_phase_set = pwm_current_phase_set;
-	else // configure new set, release ISR using current set
+	for(; slot < channels->size; slot++)
 	{
-		new_phase_set = (pwm_current_phase_set + 1) & 0x01;
-		pwm_timer_set(timer_value);
-		pwm_isr_enable(true);
+		pin = channels->pin[slot];
+		servo_data = &gpio_data[pin];
+
+		if((io_config[io_id_gpio][pin].llmode != io_pin_ll_servo) || ((target = servo_data->servo.target) == 0))
+			continue;
+
+		position = servo_data->servo.position;
+		slew = io_config[io_id_gpio][pin].speed * io_gpio_servo_ticks_per_us;
+
+		if((position == 0) || (slew == 0))
+			position = target;
+		else
+			if(position < target)
+				position = ((target - position) > slew) ? position + slew : target;
+			else
+				position = ((position - target) > slew) ? position - slew : target;
+
+		servo_data->servo.position = position;
+		gpio_set_mask(1 << pin);
+
+		slot++;
+		used += position;
+
+		return(position);
 	}
 
-	io_gpio_flags.pwm_cpu_high_speed = config_flags_get().flag.cpu_high_speed;
+	slot = 0;
+
+	if(channels->size == 0)
+		return(0);
 
-	pwm_head = -1;
+	// rest of the frame, all servo outputs low
 
-	// reset linked list
+	if((used + io_gpio_servo_lead_ticks) >= io_gpio_servo_frame_ticks)
+		return(io_gpio_servo_lead_ticks);
 
-	for(pin1 = 0; pin1 < io_gpio_pin_size; pin1++)
+	return(io_gpio_servo_frame_ticks - used);
+}
+
+// the frc1 timer is shared by the pwm, the servo outputs and one other
+// client (the i2c engine), each keeps the time of its next event in cpu
+// cycles, the timer is programmed for whichever comes first, servo edges
+// are scheduled a little early and then busy-waited for, to get
+// microsecond resolution on the pulses
+
+iram static void pwm_isr(void)
+{
+	uint32_t start, now, cycles_per_tick, lead;
+	unsigned int ticks;
+	int32_t left, servo_left, client_left;
+
+	start = read_ccount();
+
+	set_peri_reg_mask(FRC1_INT_REG, FRC1_INT_CLEAR);
+
+	stat_pwm_timer_interrupts++;
+
+	if(!pwm_isr_enabled())
 	{
-		pin1_config	= &io_config[io_id_gpio][pin1];
-		pin1_info	= &gpio_info_table[pin1];
-		pin1_data	= &gpio_data[pin1];
+		stat_pwm_timer_interrupts_while_nmi_masked++;
+		return;
+	}
+
+	cycles_per_tick = io_gpio_flags.pwm_cpu_high_speed ? 32 : 16;
+	lead = io_gpio_servo_lead_ticks * cycles_per_tick;
 
-		if((pin1_info->valid) &&
-				(pin1_config->llmode == io_pin_ll_output_analog))
+	for(;;)
+	{
+		if(io_gpio_flags.pwm_running && ((int32_t)(pwm_due - read_ccount()) < (int32_t)(2 * cycles_per_tick)))
 		{
-			pin1_data->pwm.this = pin1;
-			pin1_data->pwm.next = -1;
+			if((ticks = pwm_isr_phases(start)) == 0)
+				io_gpio_flags.pwm_running = 0;
+			else
+				pwm_due = read_ccount() + (ticks * cycles_per_tick);
 
-			if(pin1_data->pwm.duty >= pwm_period)
-				pin1_data->pwm.duty = pwm_period - 1;
+			continue;
 		}
-	}
 
-	// create linked list
-
-	phase_data = &pwm_phase[new_phase_set];
-	phase_data->init_clear_mask = 0;
-	phase_data->init_set_mask = 0;
+		if(io_gpio_flags.servo_running && ((int32_t)(servo_due - read_ccount()) < (int32_t)(2 * lead)))
+		{
+			while((int32_t)(servo_due - read_ccount()) > 0)
+				asm volatile("nop");
 
-	for(pin1 = 0; pin1 < io_gpio_pin_size; pin1++)
-	{
-		pin1_info	= &gpio_info_table[pin1];
-		pin1_config	= &io_config[io_id_gpio][pin1];
-		pin1_data	= &gpio_data[pin1];
+			if((ticks = servo_isr_edge()) == 0)
+				io_gpio_flags.servo_running = 0;
+			else
+				servo_due += ticks * cycles_per_tick;
 
-		if(!pin1_info->valid || (pin1_config->llmode != io_pin_ll_output_analog))
 			continue;
+		}
 
-		if(pin1_data->pwm.duty == 0)
-			phase_data->init_clear_mask |= 1 << pin1;
-		else
-			if((pin1_data->pwm.duty + 1) >= pwm_period)
-				phase_data->init_set_mask |= 1 << pin1;
+		if(timer_client_running && ((int32_t)(timer_client_due - read_ccount()) < (int32_t)(2 * cycles_per_tick)))
+		{
+			if((ticks = timer_client()) == 0)
+				timer_client_running = false;
 			else
-				if(pwm_head < 0)
-				{
-					pwm_head = pin1;
-					pin1_data->pwm.next = -1;
-				}
-				else
-				{
-					pin2 = pwm_head;
-					pin2_data = &gpio_data[pin2];
-
-					if(pin2_data->pwm.duty > pin1_data->pwm.duty)
-					{
-						pwm_head = pin1;
-						pin1_data->pwm.next = pin2;
-					}
-					else
-					{
-						for(pin2 = pwm_head; pin2 >= 0; pin2 = pin3)
-						{
-							pin2_data	= &gpio_data[pin2];
-							pin3		= pin2_data->pwm.next;
-
-							if(pin3 < 0)
-							{
-								pin1_data->pwm.next = -1;
-								pin2_data->pwm.next = pin1;
-
-								break;
-							}
-							else
-							{
-								pin3_data = &gpio_data[pin3];
-
-								if(pin3_data->pwm.duty > pin1_data->pwm.duty)
-								{
-									pin1_data->pwm.next = pin3;
-									pin2_data->pwm.next = pin1;
-
-									break;
-								}
-							}
-						}
-					}
-				}
+				timer_client_due = read_ccount() + (ticks * cycles_per_tick);
+
+			continue;
+		}
+
+		break;
 	}
 
-	phase_data->phase[0].duty = 0;
-	phase_data->phase[0].delay = 0;
-	phase_data->phase[0].mask = 0x0000;
-	phase_data->size = 1;
+	if(!io_gpio_flags.pwm_running && !io_gpio_flags.servo_running && !timer_client_running)
+	{
+		pwm_isr_enable(false);
+		return;
+	}
+
+	now = read_ccount();
+
+	if(io_gpio_flags.pwm_running)
+		left = pwm_due - now;
+	else
+		left = INT32_MAX;
+
+	if(io_gpio_flags.servo_running && ((servo_left = (int32_t)(servo_due - now) - (int32_t)lead) < left))
+		left = servo_left;
+
+	if(timer_client_running && ((client_left = (int32_t)(timer_client_due - now)) < left))
+		left = client_left;
+
+	if(left < (int32_t)(2 * cycles_per_tick))
+		left = 2 * cycles_per_tick;
+
+	pwm_timer_set(left / cycles_per_tick);
+}
+
+irom static void pwm_go(void)
+{
+	int pin;
+	pwm_phases_t *phase_data;
+	pwm_setup_t setup;
+	unsigned int duty[pwm_max_channels];
+	unsigned int new_phase_set, pwm_period, pwm_min_gap, dither_bits, stagger;
+	uint32_t analog_mask;
+	uint32_t timer_value;
+	bool_t isr_enabled;
+	string_init(varname_pwmperiod, "pwm.period");
+	string_init(varname_pwmmingap, "pwm.mingap");
+	string_init(varname_pwmdither, "pwm.dither");
+	string_init(varname_pwmstagger, "pwm.stagger");
 
-	for(pin1 = pwm_head, duty = 0; (phase_data->size < (io_gpio_pwm_max_channels + 1)) && (pin1 >= 0); pin1 = pin1_data->pwm.next)
+	if(!config_get_int(&varname_pwmperiod, -1, -1, &pwm_period))
+		pwm_period = 65536;
+
+	if(!config_get_int(&varname_pwmstagger, -1, -1, &stagger))
+		stagger = 0;
+
+	if(!config_get_int(&varname_pwmmingap, -1, -1, &pwm_min_gap))
+		pwm_min_gap = pwm_min_gap_default;
+
+	pwm_min_gap = pwm_min_gap_limit(pwm_period, pwm_min_gap);
+
+	if(!config_get_int(&varname_pwmdither, -1, -1, &dither_bits) || (dither_bits > pwm_dither_bits_max))
+		dither_bits = 0;
+
+	// build into the set that is neither running nor pending, the isr only
+	// ever moves from the current set to the pending set, so it won't touch
+	// this one, and can keep running meanwhile
+
+	for(new_phase_set = 0; new_phase_set < io_gpio_pwm_phase_sets; new_phase_set++)
+		if((new_phase_set != pwm_current_phase_set) && (new_phase_set != pwm_pending_phase_set))
+			break;
+
+	io_gpio_flags.pwm_cpu_high_speed = config_flags_get().flag.cpu_high_speed;
+
+	// with dithering, the duty is in units of 1 / 2^dither_bits tick
+
+	for(pin = 0, analog_mask = 0; pin < io_gpio_pin_size; pin++)
 	{
-		pin1_data = &gpio_data[pin1];
+		duty[pin] = 0;
+
+		if(!gpio_info_table[pin].valid || (io_config[io_id_gpio][pin].llmode != io_pin_ll_output_analog))
+			continue;
 
-		phase_data->phase[0].mask |= 1 << pin1;
+		analog_mask |= 1 << pin;
 
-		delta = pin1_data->pwm.duty - duty;
-		duty = pin1_data->pwm.duty;
+		if(gpio_data[pin].pwm.duty >= (pwm_period << dither_bits))
+			gpio_data[pin].pwm.duty = (pwm_period << dither_bits) - 1;
 
-		if(delta != 0)
-		{
-			phase_data->phase[phase_data->size - 1].delay	= delta;
-			phase_data->phase[phase_data->size].duty		= pin1_data->pwm.duty;
-			phase_data->phase[phase_data->size].delay		= pwm_period - 1 - pin1_data->pwm.duty;
-			phase_data->phase[phase_data->size].mask		= 1 << pin1;
-			phase_data->size++;
-		}
-		else
-			phase_data->phase[phase_data->size - 1].mask |= 1 << pin1;
+		duty[pin] = gpio_data[pin].pwm.duty;
 	}
 
-	if(phase_data->size < 2)
-		phase_data->size = 0;
+	setup.period = pwm_period;
+	setup.min_gap = pwm_min_gap;
+	setup.dither_bits = dither_bits;
+	setup.stagger = !!stagger;
+
+	phase_data = &pwm_phase[new_phase_set];
+	pwm_phases_build(phase_data, &pwm_channels, &setup, analog_mask, duty);
 
 #if 0
 	dprintf("* program");
 
 	for(phase = 0; phase < phase_data->size; phase++)
 	{
-		dprintf("phase:%d du:%d de:%d m:%x",
+		dprintf("phase:%d du:%d de:%d s:%x c:%x",
 				phase,
 				phase_data->phase[phase].duty,
 				phase_data->phase[phase].delay,
-				phase_data->phase[phase].mask);
+				phase_data->phase[phase].set_mask,
+				phase_data->phase[phase].clear_mask);
 	}
 #endif
 
-	if(new_phase_set == pwm_current_phase_set)
+	// only the hand over runs with the isr masked
+
+	isr_enabled = pwm_isr_enabled();
+	pwm_isr_enable(false);
+	timer_value = pwm_timer_get();
+
+	// the timer is reloaded, don't count the next edge as jitter
+
+	io_gpio_flags.pwm_edge_expected = 0;
+
+	if(timer_value < 32)
+		timer_value = 32;
+
+	if(timer_value > pwm_period)
+		timer_value = pwm_period;
+
+	// if the pwm is running, the isr switches to the new set at the start of
+	// the next period, this replaces a set that is still pending, otherwise
+	// make it the current set and (re)start, if only the servo outputs or
+	// the timer client are running, the isr doesn't use the phase sets
+
+	pwm_pending_phase_set = new_phase_set;
+
+	if(isr_enabled && io_gpio_flags.pwm_running)
 	{
+		io_gpio_flags.pwm_reset_phase_set = 0;
+		io_gpio_flags.pwm_next_phase_set = 1;
+	}
+	else
+	{
+		pwm_current_phase_set = new_phase_set;
 		io_gpio_flags.pwm_reset_phase_set = 1;
 		io_gpio_flags.pwm_next_phase_set = 0;
-		pwm_timer_set(timer_value);
-		pwm_isr_enable(true);
+
+		if(!io_gpio_flags.pwm_running)
+		{
+			io_gpio_flags.pwm_running = 1;
+			pwm_due = read_ccount();
+			timer_value = 32;
+		}
 	}
+
+	pwm_timer_set(timer_value);
+	pwm_isr_enable(true);
+}
+
+// servo
+
+irom static void servo_go(void)
+{
+	servo_channels_t *channels;
+	unsigned int new_channel_set;
+	uint32_t timer_value;
+	bool_t isr_enabled;
+	int pin;
+
+	isr_enabled = pwm_isr_enabled();
+	pwm_isr_enable(false);
+	timer_value = pwm_timer_get();
+
+	if(timer_value < 32)
+		timer_value = 32;
+
+	// while the frame is running, fill the other set, the ISR switches
+	// over at the start of the next frame, so no pulse is cut short
+
+	if(io_gpio_flags.servo_running)
+		new_channel_set = (servo_current_channel_set + 1) & 0x01;
 	else
+		new_channel_set = servo_current_channel_set;
+
+	channels = &servo_channel[new_channel_set];
+	channels->size = 0;
+	servo_pin_mask = 0;
+
+	for(pin = 0; (pin < io_gpio_pin_size) && (channels->size < io_gpio_servo_max_channels); pin++)
 	{
-		io_gpio_flags.pwm_reset_phase_set = 0;
-		io_gpio_flags.pwm_next_phase_set = 1;
+		if(!gpio_info_table[pin].valid || (io_config[io_id_gpio][pin].llmode != io_pin_ll_servo))
+			continue;
+
+		channels->pin[channels->size++] = pin;
+		servo_pin_mask |= 1 << pin;
+	}
+
+	if(io_gpio_flags.servo_running)
+		io_gpio_flags.servo_next_channel_set = 1;
+	else
+		if(channels->size > 0)
+		{
+			io_gpio_flags.servo_running = 1;
+			servo_due = read_ccount();
+
+			if(!isr_enabled || (timer_value > 32))
+				timer_value = 32;
+
+			isr_enabled = true;
+		}
+
+	if(isr_enabled)
+	{
+		pwm_timer_set(timer_value);
+		pwm_isr_enable(true);
 	}
 }
 
+// timer client
+
+irom void io_gpio_timer_client_start(io_gpio_timer_client_t client)
+{
+	// once running, the client picks up new work itself
+
+	if(timer_client_running)
+		return;
+
+	pwm_isr_enable(false);
+
+	timer_client = client;
+	timer_client_due = read_ccount();
+	timer_client_running = true;
+
+	pwm_timer_set(32);
+	pwm_isr_enable(true);
+}
+
+// the client won't be called anymore once this returns
+
+irom void io_gpio_timer_client_stop(void)
+{
+	bool_t isr_enabled;
+
+	isr_enabled = pwm_isr_enabled();
+	pwm_isr_enable(false);
+
+	timer_client_running = false;
+
+	if(isr_enabled)
+		pwm_isr_enable(true);
+}
+
+irom uint64_t io_gpio_timer_read64(const uint64_t *counter)
+{
+	bool_t isr_enabled;
+	uint64_t value;
+
+	isr_enabled = pwm_isr_enabled();
+	pwm_isr_enable(false);
+
+	value = *(const volatile uint64_t *)counter;
+
+	if(isr_enabled)
+		pwm_isr_enable(true);
+
+	return(value);
+}
+
 // other
 
 irom io_error_t io_gpio_init(const struct io_info_entry_T *info)
 {
+	unsigned int phase_set;
+
 	pwm_current_phase_set = 0;
+	pwm_pending_phase_set = 0;
 	io_gpio_flags.pwm_reset_phase_set = 0;
 	io_gpio_flags.pwm_next_phase_set = 0;
+	io_gpio_flags.pwm_dirty = 0;
+	io_gpio_flags.pwm_running = 0;
+	io_gpio_flags.servo_running = 0;
+	io_gpio_flags.servo_next_channel_set = 0;
+
+	for(phase_set = 0; phase_set < io_gpio_pwm_phase_sets; phase_set++)
+		pwm_phase[phase_set].size = 0;
+
+	pwm_channels.size = 0;
 
-	pwm_phase[0].size = 0;
-	pwm_phase[1].size = 0;
+	servo_current_channel_set = 0;
+	servo_channel[0].size = 0;
+	servo_channel[1].size = 0;
+	servo_pin_mask = 0;
+
+	timer_client_running = false;
 
 	gpio_init();
 	pwm_isr_setup();
 
+	ETS_GPIO_INTR_DISABLE();
+	ETS_GPIO_INTR_ATTACH(gpio_isr, (void *)0);
+	ETS_GPIO_INTR_ENABLE();
+
+	gpio_input_last = gpio_get_all();
+
 	return(io_ok);
 }
 
 iram void io_gpio_periodic(int io, const struct io_info_entry_T *info, io_data_entry_t *data, io_flags_t *flags)
 {
-	static uint32_t gpio_pc_pins_previous;
-	static bool_t first_call = true;
-
 	int pin;
-	uint32_t gpio_pc_pins_current;
+	unsigned int counter;
+	uint32_t input, changed;
+	gpio_data_pin_t *gpio_pin_data;
 
-	gpio_pc_pins_current = gpio_get_all();
+	input = gpio_get_all();
+	changed = input ^ gpio_input_last;
+	gpio_input_last = input;
 
-	if(first_call)
-	{
-		first_call = false;
-		goto end;
-	}
+	// edges are counted by the interrupt handler, only harvest the totals here
 
 	for(pin = 0; pin < io_gpio_pin_size; pin++)
 	{
-		io_config_pin_entry_t *pin_config = &io_config[io][pin];
+		gpio_pin_data = &gpio_data[pin];
 
-		if(pin_config->llmode == io_pin_ll_counter)
+		if((io_config[io][pin].llmode == io_pin_ll_input_digital) && (changed & (1 << pin)))
+			io_journal_add(io, pin, !(input & (1 << pin)), !!(input & (1 << pin)));
+
+		if(io_config[io][pin].llmode == io_pin_ll_counter)
 		{
-			gpio_data_pin_t *gpio_pin_data = &gpio_data[pin];
+			counter = gpio_pin_data->counter.counter;
 
-			if(gpio_pin_data->counter.debounce == 0)
-			{
-				if((gpio_pc_pins_previous & (1 << pin)) && !(gpio_pc_pins_current & (1 << pin)))
-				{
-					gpio_pin_data->counter.counter++;
-					gpio_pin_data->counter.debounce = pin_config->speed;
-					flags->counter_triggered = 1;
-					stat_pc_counts++;
-				}
-			}
-			else
+			if(counter != gpio_pin_data->counter.harvested)
 			{
-				if(gpio_pin_data->counter.debounce >= 10)
-					gpio_pin_data->counter.debounce -= 10; // 10 ms per tick
-				else
-					gpio_pin_data->counter.debounce = 0;
+				io_journal_add(io, pin, gpio_pin_data->counter.harvested, counter);
+				stat_pc_counts += counter - gpio_pin_data->counter.harvested;
+				gpio_pin_data->counter.harvested = counter;
+				flags->counter_triggered = 1;
 			}
 		}
-	}
 
-end:
-	gpio_pc_pins_previous = gpio_pc_pins_current;
+		if(io_config[io][pin].llmode == io_pin_ll_frequency)
+		{
+			ETS_GPIO_INTR_DISABLE();
+			io_frequency_gate(&gpio_pin_data->frequency, &io_config[io][pin], read_ccount());
+			ETS_GPIO_INTR_ENABLE();
+		}
+	}
 }
 
 irom io_error_t io_gpio_init_pin_mode(string_t *error_message, const struct io_info_entry_T *info, io_data_pin_entry_t *pin_data, const io_config_pin_entry_t *pin_config, int pin)
 {
 	gpio_info_t *gpio_info;
 	gpio_data_pin_t *gpio_pin_data;
+	uint32_t debounce;
 
 	if((pin < 0) || (pin >= io_gpio_pin_size))
 	{
@@ -631,8 +1056,22 @@ irom io_error_t io_gpio_init_pin_mode(string_t *error_message, const struct io_i
 	gpio_func_select(pin, gpio_info->func);
 	gpio_pin_intr_state_set(pin, GPIO_PIN_INTR_DISABLE);
 
+	if(pin_config->llmode != io_pin_ll_input_digital)
+		gpio_edge_mask &= ~(1 << pin);
+
 	gpio_pin_data = &gpio_data[pin];
 
+	// pin leaves servo mode, drop it from the servo frame, the old channel
+	// set may still be in use until the end of the frame, so make sure it
+	// skips the pin
+
+	if((pin_config->llmode != io_pin_ll_servo) && (servo_pin_mask & (1 << pin)))
+	{
+		gpio_pin_data->servo.target = 0;
+		gpio_pin_data->servo.position = 0;
+		servo_go();
+	}
+
 	switch(pin_config->llmode)
 	{
 		case(io_pin_ll_input_digital):
@@ -643,10 +1082,46 @@ irom io_error_t io_gpio_init_pin_mode(string_t *error_message, const struct io_i
 
 			if(pin_config->llmode == io_pin_ll_counter)
 			{
+				// count falling edges in the interrupt handler, debounce delay is in ms,
+				// io-mode and io_init keep it within range
+
+				debounce = pin_config->speed;
+
+				ETS_GPIO_INTR_DISABLE();
+
 				gpio_pin_data->counter.counter = 0;
-				gpio_pin_data->counter.debounce = 0;
+				gpio_pin_data->counter.harvested = 0;
+				gpio_pin_data->counter.debounce = debounce * 1000;
+				gpio_pin_data->counter.last = system_get_time() - gpio_pin_data->counter.debounce;
+
+				gpio_reg_write(GPIO_STATUS_W1TC_ADDRESS, 1 << pin);
+				gpio_pin_intr_state_set(pin, GPIO_PIN_INTR_NEGEDGE);
+
+				ETS_GPIO_INTR_ENABLE();
 			}
 
+			if(gpio_edge_mask & (1 << pin))
+				gpio_pin_intr_state_set(pin, GPIO_PIN_INTR_POSEDGE);
+
+			break;
+		}
+
+		case(io_pin_ll_frequency):
+		{
+			gpio_direction(pin, 0);
+			gpio_pullup(pin, pin_config->flags.pullup);
+
+			// timestamp falling edges in the interrupt handler
+
+			ETS_GPIO_INTR_DISABLE();
+
+			io_frequency_init(&gpio_pin_data->frequency);
+
+			gpio_reg_write(GPIO_STATUS_W1TC_ADDRESS, 1 << pin);
+			gpio_pin_intr_state_set(pin, GPIO_PIN_INTR_NEGEDGE);
+
+			ETS_GPIO_INTR_ENABLE();
+
 			break;
 		}
 
@@ -666,6 +1141,30 @@ irom io_error_t io_gpio_init_pin_mode(string_t *error_message, const struct io_i
 			break;
 		}
 
+		case(io_pin_ll_servo):
+		{
+			int other, channels;
+
+			for(other = 0, channels = 0; other < io_gpio_pin_size; other++)
+				if((other != pin) && (io_config[io_id_gpio][other].llmode == io_pin_ll_servo))
+					channels++;
+
+			if(channels >= io_gpio_servo_max_channels)
+			{
+				if(error_message)
+					string_format(error_message, "no more than %d servo channels\n", io_gpio_servo_max_channels);
+				return(io_error);
+			}
+
+			gpio_direction(pin, 1);
+			gpio_set(pin, 0);
+			gpio_pin_data->servo.target = 0;
+			gpio_pin_data->servo.position = 0;
+			servo_go();
+
+			break;
+		}
+
 		case(io_pin_ll_i2c):
 		{
 			gpio_direction(pin, 0);
@@ -706,11 +1205,30 @@ irom io_error_t io_gpio_init_pin_mode(string_t *error_message, const struct io_i
 	return(io_ok);
 }
 
+// number of duty steps of an analog output, with dithering the duty is
+// in units of 1 / 2^dither_bits timer tick
+
+irom unsigned int io_gpio_pwm_range(void)
+{
+	unsigned int pwm_period, pwm_dither;
+	string_init(varname_pwmperiod, "pwm.period");
+	string_init(varname_pwmdither, "pwm.dither");
+
+	if(!config_get_int(&varname_pwmperiod, -1, -1, &pwm_period))
+		pwm_period = 65536;
+
+	if(!config_get_int(&varname_pwmdither, -1, -1, &pwm_dither) || (pwm_dither > pwm_dither_bits_max))
+		pwm_dither = 0;
+
+	return(pwm_period << pwm_dither);
+}
+
 irom io_error_t io_gpio_get_pin_info(string_t *dst, const struct io_info_entry_T *info, io_data_pin_entry_t *pin_data, const io_config_pin_entry_t *pin_config, int pin)
 {
 	gpio_data_pin_t *gpio_pin_data;
-	unsigned int pwm_period;
+	unsigned int pwm_period, pwm_dither;
 	string_init(varname_pwmperiod, "pwm.period");
+	string_init(varname_pwmdither, "pwm.dither");
 
 	if((pin < 0) || (pin >= io_gpio_pin_size))
 		return(io_error);
@@ -718,6 +1236,9 @@ irom io_error_t io_gpio_get_pin_info(string_t *dst, const struct io_info_entry_T
 	if(!config_get_int(&varname_pwmperiod, -1, -1, &pwm_period))
 		pwm_period = 65536;
 
+	if(!config_get_int(&varname_pwmdither, -1, -1, &pwm_dither) || (pwm_dither > pwm_dither_bits_max))
+		pwm_dither = 0;
+
 	gpio_pin_data = &gpio_data[pin];
 
 	if(!gpio_info_table[pin].valid)
@@ -728,8 +1249,15 @@ irom io_error_t io_gpio_get_pin_info(string_t *dst, const struct io_info_entry_T
 		{
 			case(io_pin_ll_counter):
 			{
-				string_format(dst, "current state: %s, debounce delay: %d",
-						onoff(gpio_get(pin)), gpio_pin_data->counter.debounce);
+				string_format(dst, "current state: %s, debounce delay: %u ms",
+						onoff(gpio_get(pin)), pin_config->speed);
+
+				break;
+			}
+
+			case(io_pin_ll_frequency):
+			{
+				io_frequency_info(dst, &gpio_pin_data->frequency);
 
 				break;
 			}
@@ -749,11 +1277,11 @@ irom io_error_t io_gpio_get_pin_info(string_t *dst, const struct io_info_entry_T
 				duty = gpio_pin_data->pwm.duty;
 				frequency = 5000000 / pwm_period;
 
-				dutypct = duty * 100 / (pwm_period - 1);
-				dutypctfraction = duty * 10000 / (pwm_period - 1);
+				dutypct = (uint64_t)duty * 100 / ((pwm_period << pwm_dither) - 1);
+				dutypctfraction = (uint64_t)duty * 10000 / ((pwm_period << pwm_dither) - 1);
 				dutypctfraction -= dutypct * 100;
 
-				if(!pwm_isr_enabled())
+				if(!io_gpio_flags.pwm_running)
 					frequency = 0;
 
 				string_format(dst, "frequency: %u Hz, duty: %u (%u.%02u %%), state: %s",
@@ -762,6 +1290,16 @@ irom io_error_t io_gpio_get_pin_info(string_t *dst, const struct io_info_entry_T
 				break;
 			}
 
+			case(io_pin_ll_servo):
+			{
+				string_format(dst, "frame: 20 ms, position: %u us, target: %u us, slew: %u us/frame",
+						gpio_pin_data->servo.position / io_gpio_servo_ticks_per_us,
+						gpio_pin_data->servo.target / io_gpio_servo_ticks_per_us,
+						pin_config->speed);
+
+				break;
+			}
+
 			case(io_pin_ll_uart):
 			{
 				string_format(dst, "uart pin: %s", (gpio_info_table[pin].uart_pin == io_uart_rx) ? "rx" : "tx");
@@ -810,6 +1348,13 @@ irom io_error_t io_gpio_read_pin(string_t *error_message, const struct io_info_e
 			break;
 		}
 
+		case(io_pin_ll_frequency):
+		{
+			*value = io_frequency_value(&gpio_pin_data->frequency);
+
+			break;
+		}
+
 		case(io_pin_ll_output_analog):
 		{
 			*value = gpio_pin_data->pwm.duty;
@@ -817,6 +1362,13 @@ irom io_error_t io_gpio_read_pin(string_t *error_message, const struct io_info_e
 			break;
 		}
 
+		case(io_pin_ll_servo):
+		{
+			*value = gpio_pin_data->servo.position / io_gpio_servo_ticks_per_us;
+
+			break;
+		}
+
 		default:
 		{
 			if(error_message)
@@ -845,7 +1397,10 @@ irom io_error_t io_gpio_write_pin(string_t *error_message, const struct io_info_
 	{
 		case(io_pin_ll_counter):
 		{
+			ETS_GPIO_INTR_DISABLE();
 			gpio_pin_data->counter.counter = value;
+			gpio_pin_data->counter.harvested = value;
+			ETS_GPIO_INTR_ENABLE();
 			break;
 		}
 
@@ -862,16 +1417,39 @@ irom io_error_t io_gpio_write_pin(string_t *error_message, const struct io_info_
 			if(value < 0)
 				value = 0;
 
+			// the phase table is rebuilt once, in io_gpio_flush,
+			// for all pins changed within this tick or command
+
 			if(gpio_pin_data->pwm.duty != (unsigned int)value)
 			{
 				gpio_pin_data->pwm.duty = value;
-				pwm_go();
+				io_gpio_flags.pwm_dirty = 1;
 			}
 
 			break;
 
 		}
 
+		case(io_pin_ll_servo):
+		{
+			// pulse width in us, 0 stops the pulses, the ISR picks up
+			// the new target at the start of the next pulse
+
+			if((value != 0) && ((value < io_gpio_servo_min_us) || (value > io_gpio_servo_max_us)))
+			{
+				if(error_message)
+					string_format(error_message, "servo pulse must be 0 or %d-%d us\n", io_gpio_servo_min_us, io_gpio_servo_max_us);
+				return(io_error);
+			}
+
+			gpio_pin_data->servo.target = value * io_gpio_servo_ticks_per_us;
+
+			if(value == 0)
+				gpio_pin_data->servo.position = 0;
+
+			break;
+		}
+
 		default:
 		{
 			if(error_message)
@@ -883,10 +1461,40 @@ irom io_error_t io_gpio_write_pin(string_t *error_message, const struct io_info_
 	return(io_ok);
 }
 
+iram io_error_t io_gpio_write_mask(string_t *error_message, const struct io_info_entry_T *info, unsigned int mask, unsigned int values)
+{
+	gpio_set_mask(mask & values);
+	gpio_clear_mask(mask & ~values);
+
+	return(io_ok);
+}
+
+irom io_error_t io_gpio_flush(string_t *error_message, const struct io_info_entry_T *info, bool_t wait)
+{
+	if(io_gpio_flags.pwm_dirty)
+	{
+		io_gpio_flags.pwm_dirty = 0;
+		pwm_go();
+	}
+
+	return(io_ok);
+}
+
+iram io_error_t io_gpio_read_port(string_t *error_message, const struct io_info_entry_T *info, unsigned int *values)
+{
+	*values = gpio_get_all() & 0xffff;
+
+	return(io_ok);
+}
+
 irom app_action_t application_function_pwm_period(const string_t *src, string_t *dst)
 {
-	int new_pwm_period;
+	int new_pwm_period, new_pwm_min_gap, new_pwm_dither, new_pwm_stagger;
+	unsigned int phases, cycles_per_us;
 	string_init(varname_pwmperiod, "pwm.period");
+	string_init(varname_pwmmingap, "pwm.mingap");
+	string_init(varname_pwmdither, "pwm.dither");
+	string_init(varname_pwmstagger, "pwm.stagger");
 
 	if(parse_int(1, src, &new_pwm_period, 0, ' ') == parse_ok)
 	{
@@ -896,6 +1504,39 @@ irom app_action_t application_function_pwm_period(const string_t *src, string_t
 			return(app_action_error);
 		}
 
+		if(parse_int(2, src, &new_pwm_min_gap, 0, ' ') == parse_ok)
+		{
+			if((new_pwm_min_gap < 0) || (new_pwm_min_gap > 1024))
+			{
+				string_format(dst, "pwm-period: invalid min gap: %d (must be 0-1024)\n", new_pwm_min_gap);
+				return(app_action_error);
+			}
+
+			config_set_int(&varname_pwmmingap, -1, -1, new_pwm_min_gap);
+		}
+
+		if(parse_int(3, src, &new_pwm_dither, 0, ' ') == parse_ok)
+		{
+			if((new_pwm_dither < 0) || (new_pwm_dither > pwm_dither_bits_max))
+			{
+				string_format(dst, "pwm-period: invalid dither bits: %d (must be 0-%d)\n", new_pwm_dither, pwm_dither_bits_max);
+				return(app_action_error);
+			}
+
+			config_set_int(&varname_pwmdither, -1, -1, new_pwm_dither);
+		}
+
+		if(parse_int(4, src, &new_pwm_stagger, 0, ' ') == parse_ok)
+		{
+			if((new_pwm_stagger < 0) || (new_pwm_stagger > 1))
+			{
+				string_format(dst, "pwm-period: invalid stagger: %d (must be 0 or 1)\n", new_pwm_stagger);
+				return(app_action_error);
+			}
+
+			config_set_int(&varname_pwmstagger, -1, -1, new_pwm_stagger);
+		}
+
 		config_set_int(&varname_pwmperiod, -1, -1, new_pwm_period);
 
 		pwm_go();
@@ -904,7 +1545,28 @@ irom app_action_t application_function_pwm_period(const string_t *src, string_t
 	if(!config_get_int(&varname_pwmperiod, -1, -1, &new_pwm_period))
 		new_pwm_period = 65536;
 
-	string_format(dst, "pwm_period: %d\n", new_pwm_period);
+	if(!config_get_int(&varname_pwmmingap, -1, -1, &new_pwm_min_gap))
+		new_pwm_min_gap = pwm_min_gap_default;
+
+	if(!config_get_int(&varname_pwmdither, -1, -1, &new_pwm_dither))
+		new_pwm_dither = 0;
+
+	if(!config_get_int(&varname_pwmstagger, -1, -1, &new_pwm_stagger))
+		new_pwm_stagger = 0;
+
+	string_format(dst, "pwm_period: %d, min gap: %d (used: %u), dither bits: %d (duty range 0-%d), staggered: %s, phases: %u\n",
+			new_pwm_period, new_pwm_min_gap, pwm_min_gap_limit(new_pwm_period, new_pwm_min_gap),
+			new_pwm_dither, (new_pwm_period << new_pwm_dither) - 1,
+			yesno(new_pwm_stagger), pwm_phase[pwm_current_phase_set].size);
+
+	// worst case time of one interrupt, for each number of phases seen
+
+	cycles_per_us = system_get_cpu_freq();
+
+	for(phases = 0; phases < (pwm_max_phases + 1); phases++)
+		if(pwm_isr_max_cycles[phases] > 0)
+			string_format(dst, "> phases: %2u, worst case isr time: %u us\n",
+					phases, pwm_isr_max_cycles[phases] / cycles_per_us);
 
 	return(app_action_normal);
 }
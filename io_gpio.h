@@ -13,6 +13,26 @@ io_error_t	io_gpio_init_pin_mode(string_t *, const struct io_info_entry_T *, io_
 io_error_t	io_gpio_get_pin_info(string_t *, const struct io_info_entry_T *, io_data_pin_entry_t *, const io_config_pin_entry_t *, int);
 io_error_t	io_gpio_read_pin(string_t *, const struct io_info_entry_T *, io_data_pin_entry_t *, const io_config_pin_entry_t *, int, int *);
 io_error_t	io_gpio_write_pin(string_t *, const struct io_info_entry_T *, io_data_pin_entry_t *, const io_config_pin_entry_t *, int, int);
+io_error_t	io_gpio_write_mask(string_t *, const struct io_info_entry_T *, unsigned int, unsigned int);
+io_error_t	io_gpio_read_port(string_t *, const struct io_info_entry_T *, unsigned int *);
+io_error_t	io_gpio_flush(string_t *, const struct io_info_entry_T *, bool_t wait);
+bool_t		io_gpio_edge_detect(int pin);
+bool_t		io_gpio_edge_pending(int pin);
+unsigned int io_gpio_pwm_range(void);
+
+// a client of the frc1 timer, called from the (nmi) timer interrupt, so it must
+// be in iram, returns the delay until the next call in timer ticks (200 ns),
+// 0 to stop until started again
+
+typedef unsigned int (*io_gpio_timer_client_t)(void);
+
+void		io_gpio_timer_client_start(io_gpio_timer_client_t);
+void		io_gpio_timer_client_stop(void);
+
+// read a 64 bit counter that the timer interrupt updates, the two halves
+// can't be read atomically, so the interrupt is masked meanwhile
+
+uint64_t	io_gpio_timer_read64(const uint64_t *);
 
 app_action_t application_function_pwm_period(const string_t *src, string_t *dst);
 
@@ -1,5 +1,8 @@
 #include "io_mcp.h"
+#include "io_gpio.h"
 #include "i2c.h"
+#include "config.h"
+#include "stats.h"
 #include "util.h"
 
 #include <user_interface.h>
@@ -56,17 +59,46 @@ static int instance_index(const struct io_info_entry_T *info)
 	return(info->instance - io_mcp_instance_first);
 }
 
+enum
+{
+	mcp_fallback_poll_ticks = 100,	// 1 s
+};
+
+typedef struct
+{
+	int int_gpio;
+	unsigned int poll_countdown;
+} mcp_interrupt_t;
+
+// the INTF, INTCAP and GPIO registers are polled asynchronously, the read
+// is queued at one tick and its result is used at the next
+
+typedef struct
+{
+	uint8_t			registers[6];	// INTFA, INTFB, INTCAPA, INTCAPB, GPIOA, GPIOB
+	i2c_error_t		error;
+	unsigned int	queued:1;
+	unsigned int	done:1;
+} mcp_poll_t;
+
+static mcp_poll_t mcp_poll[io_mcp_instance_size];
 static uint8_t pin_output_cache[io_mcp_instance_size][2];
+static uint8_t pin_input_cache[io_mcp_instance_size][2];
+static uint8_t pin_output_mask[io_mcp_instance_size][2];
 static mcp_data_pin_t mcp_data_pin_table[io_mcp_instance_size][16];
+static mcp_interrupt_t mcp_interrupt[io_mcp_instance_size];
 
-iram static io_error_t read_register(string_t *error_message, int address, int reg, int *value)
+// the registers are used in "BANK=0" mode, so the A and B registers are
+// adjacent, with SEQOP=0 (sequential operation) the register address
+// auto-increments, so a block of registers is transferred in one go
+
+iram static io_error_t read_registers(string_t *error_message, int address, int reg, int length, uint8_t *values)
 {
-	uint8_t i2cbuffer[2];
 	i2c_error_t error;
 
-	i2cbuffer[0] = reg;
+	stat_mcp_i2c_transactions++;
 
-	if((error = i2c_send(address, true, 1, &i2cbuffer[0])) != i2c_error_ok)
+	if((error = i2c_receive_block(address, reg, length, values)) != i2c_error_ok)
 	{
 		if(error_message)
 			i2c_error_format_string(error_message, error);
@@ -74,28 +106,16 @@ iram static io_error_t read_register(string_t *error_message, int address, int r
 		return(io_error);
 	}
 
-	if((error = i2c_receive(address, 1, &i2cbuffer[1])) != i2c_error_ok)
-	{
-		if(error_message)
-			i2c_error_format_string(error_message, error);
-
-		return(io_error);
-	}
-
-	*value = i2cbuffer[1];
-
 	return(io_ok);
 }
 
-iram static io_error_t write_register(string_t *error_message, int address, int reg, int value)
+iram static io_error_t write_registers(string_t *error_message, int address, int reg, int length, const uint8_t *values)
 {
-	uint8_t i2cbuffer[2];
 	i2c_error_t error;
 
-	i2cbuffer[0] = reg;
-	i2cbuffer[1] = value;
+	stat_mcp_i2c_transactions++;
 
-	if((error = i2c_send(address, true, 2, &i2cbuffer[0])) != i2c_error_ok)
+	if((error = i2c_send_block(address, reg, length, values)) != i2c_error_ok)
 	{
 		if(error_message)
 			i2c_error_format_string(error_message, error);
@@ -106,41 +126,25 @@ iram static io_error_t write_register(string_t *error_message, int address, int
 	return(io_ok);
 }
 
-iram static io_error_t clear_set_register(string_t *error_message, int address, int reg, int clearmask, int setmask)
+iram static io_error_t read_register(string_t *error_message, int address, int reg, int *value)
 {
-	uint8_t i2cbuffer[2];
-	i2c_error_t error;
-
-	i2cbuffer[0] = reg;
-
-	if((error = i2c_send(address, true, 1, &i2cbuffer[0])) != i2c_error_ok)
-	{
-		if(error_message)
-			i2c_error_format_string(error_message, error);
+	uint8_t i2cbuffer[1];
 
+	if(read_registers(error_message, address, reg, 1, i2cbuffer) != io_ok)
 		return(io_error);
-	}
 
-	if((error = i2c_receive(address, 1, &i2cbuffer[1])) != i2c_error_ok)
-	{
-		if(error_message)
-			i2c_error_format_string(error_message, error);
+	*value = i2cbuffer[0];
 
-		return(io_error);
-	}
-
-	i2cbuffer[1] &= ~clearmask;
-	i2cbuffer[1] |= setmask;
+	return(io_ok);
+}
 
-	if((error = i2c_send(address, true, 2, &i2cbuffer[0])) != i2c_error_ok)
-	{
-		if(error_message)
-			i2c_error_format_string(error_message, error);
+iram static io_error_t write_register(string_t *error_message, int address, int reg, int value)
+{
+	uint8_t i2cbuffer[1];
 
-		return(io_error);
-	}
+	i2cbuffer[0] = value;
 
-	return(io_ok);
+	return(write_registers(error_message, address, reg, 1, i2cbuffer));
 }
 
 irom io_error_t io_mcp_init(const struct io_info_entry_T *info)
@@ -149,6 +153,28 @@ irom io_error_t io_mcp_init(const struct io_info_entry_T *info)
 	int iocon_value = (1 << DISSLW) | (1 << INTPOL);
 	uint8_t i2c_buffer[0x01];
 	mcp_data_pin_t *mcp_pin_data;
+	mcp_interrupt_t *interrupt;
+	string_init(varname_int_gpio, "io.%u.int.gpio");
+
+	// optionally the INT output is connected to a gpio input pin,
+	// then the registers only need to be read when it's asserted,
+	// mirror INTA/INTB so one pin covers both banks
+
+	interrupt = &mcp_interrupt[instance_index(info)];
+	interrupt->poll_countdown = 0;
+
+	if(!config_get_int(&varname_int_gpio, io_id_mcp_20 + instance_index(info), -1, &interrupt->int_gpio))
+		interrupt->int_gpio = -1;
+
+	if((interrupt->int_gpio >= 0) && !io_gpio_edge_detect(interrupt->int_gpio))
+		interrupt->int_gpio = -1;
+
+	if(interrupt->int_gpio >= 0)
+		iocon_value |= 1 << MIRROR;
+
+	// io expanders go before the sensors, register reads are merged
+
+	i2c_set_device(info->address, i2c_priority_high, true);
 
 	if(i2c_send_2(info->address, IOCON(0), iocon_value) != i2c_error_ok)
 		return(io_error);
@@ -168,32 +194,134 @@ irom io_error_t io_mcp_init(const struct io_info_entry_T *info)
 
 	pin_output_cache[instance_index(info)][0] = 0;
 	pin_output_cache[instance_index(info)][1] = 0;
+	pin_output_mask[instance_index(info)][0] = 0;
+	pin_output_mask[instance_index(info)][1] = 0;
+
+	mcp_poll[instance_index(info)].queued = 0;
+	mcp_poll[instance_index(info)].done = 0;
 
 	return(io_ok);
 }
 
+irom static void mcp_poll_callback(const i2c_transaction_t *transaction)
+{
+	mcp_poll_t *poll = (mcp_poll_t *)transaction->context;
+
+	poll->error = transaction->error;
+	poll->queued = 0;
+	poll->done = 1;
+}
+
+irom static void mcp_poll_queue(const struct io_info_entry_T *info, mcp_poll_t *poll)
+{
+	i2c_transaction_t transaction;
+
+	transaction.address = info->address;
+	transaction.bus = 0;
+	transaction.priority = i2c_priority_high;
+	transaction.reg = INTF(0);
+	transaction.send_length = 0;
+	transaction.send = (const uint8_t *)0;
+	transaction.receive_length = sizeof(poll->registers);
+	transaction.receive = poll->registers;
+	transaction.stop = true;
+	transaction.callback = mcp_poll_callback;
+	transaction.context = poll;
+
+	if(i2c_queue(&transaction) == i2c_error_ok)
+	{
+		stat_mcp_i2c_transactions++;
+		poll->queued = 1;
+	}
+}
+
 iram void io_mcp_periodic(int io, const struct io_info_entry_T *info, io_data_entry_t *data, io_flags_t *flags)
 {
 	int pin;
-	int intf[2], intcap[2];
-	int bank, bankpin;
+	uint8_t intf_intcap_gpio[6]; // INTFA, INTFB, INTCAPA, INTCAPB, GPIOA, GPIOB
+	uint8_t *intf = &intf_intcap_gpio[0];
+	uint8_t *intcap = &intf_intcap_gpio[2];
+	uint8_t *gpio = &intf_intcap_gpio[4];
+	uint8_t *cache;
+	bool_t sampled;
+	int bank, bankpin, mask;
 	mcp_data_pin_t *mcp_pin_data;
 	io_config_pin_entry_t *pin_config;
+	mcp_interrupt_t *interrupt;
+	mcp_poll_t *poll;
+
+	interrupt = &mcp_interrupt[instance_index(info)];
+	poll = &mcp_poll[instance_index(info)];
+	cache = pin_input_cache[instance_index(info)];
+	sampled = false;
 
-	read_register((string_t *)0, info->address, INTF(0), &intf[0]);
-	read_register((string_t *)0, info->address, INTF(1), &intf[1]);
+	if(poll->done)
+	{
+		poll->done = 0;
+
+		if(poll->error == i2c_error_ok)
+		{
+			memcpy(intf_intcap_gpio, poll->registers, sizeof(intf_intcap_gpio));
+			sampled = true;
+		}
+	}
 
-	read_register((string_t *)0, info->address, INTCAP(0), &intcap[0]);
-	read_register((string_t *)0, info->address, INTCAP(1), &intcap[1]);
+	if(!sampled)
+		memset(intf_intcap_gpio, 0, sizeof(intf_intcap_gpio));
+
+	// with the INT output connected, skip reading unless it's asserted (edge
+	// seen or still active), but do poll once in a while in case an edge got lost
+
+	if(!poll->queued)
+	{
+		if((interrupt->int_gpio >= 0) && !io_gpio_edge_pending(interrupt->int_gpio) &&
+				!gpio_get(interrupt->int_gpio) && (interrupt->poll_countdown > 0))
+		{
+			interrupt->poll_countdown--;
+			stat_mcp_i2c_saved++;
+		}
+		else
+		{
+			interrupt->poll_countdown = mcp_fallback_poll_ticks;
+			mcp_poll_queue(info, poll);
+		}
+	}
 
 	for(pin = 0; pin < 16; pin++)
 	{
 		bank = (pin & 0x08) >> 3;
 		bankpin = pin & 0x07;
+		mask = 1 << bankpin;
 
 		mcp_pin_data = &mcp_data_pin_table[info->instance][pin];
 		pin_config = &io_config[io][pin];
 
+		// INTCAP holds the pin state at the time of the (first) change, GPIO
+		// the current state, the pin may have changed again in between,
+		// the cache always follows GPIO
+
+		if((pin_config->llmode == io_pin_ll_input_digital) && sampled)
+		{
+			if((intf[bank] & mask) && ((intcap[bank] ^ cache[bank]) & mask))
+			{
+				io_journal_add(io, pin, !!(cache[bank] & mask), !!(intcap[bank] & mask));
+				cache[bank] ^= mask;
+			}
+
+			if((gpio[bank] ^ cache[bank]) & mask)
+			{
+				io_journal_add(io, pin, !!(cache[bank] & mask), !!(gpio[bank] & mask));
+				cache[bank] ^= mask;
+			}
+		}
+
+		// reading GPIO clears the interrupt state (INTF, INTCAP), so reads
+		// are served from the cache, for the other pins it follows GPIO without
+		// journaling
+
+		if((pin_config->llmode != io_pin_ll_input_digital) && sampled)
+			cache[bank] = (cache[bank] & ~mask) | (gpio[bank] & mask);
+
 		if(pin_config->llmode == io_pin_ll_counter)
 		{
 			if(mcp_pin_data->debounce != 0)
@@ -205,8 +333,9 @@ iram void io_mcp_periodic(int io, const struct io_info_entry_T *info, io_data_en
 			}
 			else
 			{
-				if((intf[bank] & (1 << bankpin)) && !(intcap[bank] & (1 << bankpin))) // only count downward edge, counter is mostly pull-up
+				if((intf[bank] & mask) && !(intcap[bank] & mask)) // only count downward edge, counter is mostly pull-up
 				{
+					io_journal_add(io, pin, mcp_pin_data->counter, mcp_pin_data->counter + 1);
 					mcp_pin_data->counter++;
 					mcp_pin_data->debounce = pin_config->speed;
 					flags->counter_triggered = 1;
@@ -218,31 +347,26 @@ iram void io_mcp_periodic(int io, const struct io_info_entry_T *info, io_data_en
 
 irom io_error_t io_mcp_init_pin_mode(string_t *error_message, const struct io_info_entry_T *info, io_data_pin_entry_t *pin_data, const io_config_pin_entry_t *pin_config, int pin)
 {
-	int bank, bankpin;
+	int bank, bankpin, mask;
+	uint8_t regs[_GPPU + 2]; // IODIRA ... GPPUB
+	uint8_t olat;
 
 	bank = (pin & 0x08) >> 3;
 	bankpin = pin & 0x07;
+	mask = 1 << bankpin;
 
-	if(clear_set_register(error_message, info->address, IPOL(bank), 1 << bankpin, 0) != io_ok) // polarity inversion = 0
-		return(io_error);
+	// read all configuration registers in one transaction, update them and write them back
 
-	if(clear_set_register(error_message, info->address, GPINTEN(bank), 1 << bankpin, 0) != io_ok) // pc int enable = 0
+	if(read_registers(error_message, info->address, IODIR(0), sizeof(regs), regs) != io_ok)
 		return(io_error);
 
-	if(clear_set_register(error_message, info->address, DEFVAL(bank), 1 << bankpin, 0) != io_ok) // compare value = 0
-		return(io_error);
+	regs[IPOL(bank)] &= ~mask;		// polarity inversion = 0
+	regs[GPINTEN(bank)] &= ~mask;	// pc int enable = 0
+	regs[DEFVAL(bank)] &= ~mask;	// compare value = 0
+	regs[INTCON(bank)] &= ~mask;	// compare source = 0
+	regs[GPPU(bank)] &= ~mask;		// pullup = 0
 
-	if(clear_set_register(error_message, info->address, INTCON(bank), 1 << bankpin, 0) != io_ok) // compare source = 0
-		return(io_error);
-
-	if(clear_set_register(error_message, info->address, GPPU(bank), 1 << bankpin, 0) != io_ok) // pullup = 0
-		return(io_error);
-
-	if(clear_set_register(error_message, info->address, GPIO(bank), 1 << bankpin, 0) != io_ok) // gpio = 0
-		return(io_error);
-
-	if(clear_set_register(error_message, info->address, OLAT(bank), 1 << bankpin, 0) != io_ok) // latch = 0
-		return(io_error);
+	pin_output_mask[instance_index(info)][bank] &= ~mask;
 
 	switch(pin_config->llmode)
 	{
@@ -254,22 +378,20 @@ irom io_error_t io_mcp_init_pin_mode(string_t *error_message, const struct io_in
 		case(io_pin_ll_input_digital):
 		case(io_pin_ll_counter):
 		{
-			if(clear_set_register(error_message, info->address, IODIR(bank), 0, 1 << bankpin) != io_ok) // direction = 1
-				return(io_error);
+			regs[IODIR(bank)] |= mask;	// direction = 1
 
-			if(pin_config->flags.pullup && (clear_set_register(error_message, info->address, GPPU(bank), 0, 1 << bankpin) != io_ok))
-				return(io_error);
+			if(pin_config->flags.pullup)
+				regs[GPPU(bank)] |= mask;
 
-			if((pin_config->llmode == io_pin_ll_counter) && (clear_set_register(error_message, info->address, GPINTEN(bank), 0, 1 << bankpin) != io_ok)) // pc int enable = 1
-				return(io_error);
+			regs[GPINTEN(bank)] |= mask;	// pc int enable = 1, for counting and the change journal
 
 			break;
 		}
 
 		case(io_pin_ll_output_digital):
 		{
-			if(clear_set_register(error_message, info->address, IODIR(bank), 1 << bankpin, 0) != io_ok) // direction = 0
-				return(io_error);
+			regs[IODIR(bank)] &= ~mask;	// direction = 0
+			pin_output_mask[instance_index(info)][bank] |= mask;
 
 			break;
 		}
@@ -283,6 +405,26 @@ irom io_error_t io_mcp_init_pin_mode(string_t *error_message, const struct io_in
 		}
 	}
 
+	// latch = 0, before the direction is changed
+
+	if(read_registers(error_message, info->address, OLAT(bank), 1, &olat) != io_ok)
+		return(io_error);
+
+	olat &= ~mask;
+
+	if(write_registers(error_message, info->address, OLAT(bank), 1, &olat) != io_ok)
+		return(io_error);
+
+	if(write_registers(error_message, info->address, IODIR(0), sizeof(regs), regs) != io_ok)
+		return(io_error);
+
+	if(read_registers(error_message, info->address, GPIO(0), 2, pin_input_cache[instance_index(info)]) != io_ok)
+		return(io_error);
+
+	// the GPIO read above cleared a pending interrupt, don't wait for INT
+
+	mcp_interrupt[instance_index(info)].poll_countdown = 0;
+
 	return(io_ok);
 }
 
@@ -301,30 +443,21 @@ irom io_error_t io_mcp_get_pin_info(string_t *dst, const struct io_info_entry_T
 	{
 		case(io_pin_ll_input_analog):
 		{
-			if(read_register(dst, info->address, GPIO(bank), &tv) != io_ok)
-				return(io_error);
-
-			string_format(dst, "current io: %s", onoff(tv & (1 << bankpin)));
+			string_format(dst, "current io: %s", onoff(pin_input_cache[instance_index(info)][bank] & (1 << bankpin)));
 
 			break;
 		}
 
 		case(io_pin_ll_counter):
 		{
-			if(read_register(dst, info->address, GPIO(bank), &tv) != io_ok)
-				return(io_error);
-
-			string_format(dst, "current io: %s, debounce: %d", onoff(tv & (1 << bankpin)), mcp_pin_data->debounce);
+			string_format(dst, "current io: %s, debounce: %d", onoff(pin_input_cache[instance_index(info)][bank] & (1 << bankpin)), mcp_pin_data->debounce);
 
 			break;
 		}
 
 		case(io_pin_ll_output_digital):
 		{
-			if(read_register(dst, info->address, GPIO(bank), &tv) != io_ok)
-				return(io_error);
-
-			io = tv & (1 << bankpin);
+			io = pin_input_cache[instance_index(info)][bank] & (1 << bankpin);
 
 			if(read_register(dst, info->address, OLAT(bank), &tv) != io_ok)
 				return(io_error);
@@ -347,7 +480,7 @@ irom io_error_t io_mcp_get_pin_info(string_t *dst, const struct io_info_entry_T
 
 iram io_error_t io_mcp_read_pin(string_t *error_message, const struct io_info_entry_T *info, io_data_pin_entry_t *pin_data, const io_config_pin_entry_t *pin_config, int pin, int *value)
 {
-	int bank, bankpin, tv;
+	int bank, bankpin;
 	mcp_data_pin_t *mcp_pin_data;
 
 	bank = (pin & 0x08) >> 3;
@@ -358,12 +491,15 @@ iram io_error_t io_mcp_read_pin(string_t *error_message, const struct io_info_en
 	switch(pin_config->llmode)
 	{
 		case(io_pin_ll_input_digital):
-		case(io_pin_ll_output_digital):
 		{
-			if(read_register(error_message, info->address, GPIO(bank), &tv) != io_ok)
-				return(io_error);
+			*value = !!(pin_input_cache[instance_index(info)][bank] & (1 << bankpin));
 
-			*value = !!(tv & (1 << bankpin));
+			break;
+		}
+
+		case(io_pin_ll_output_digital):
+		{
+			*value = !!(pin_output_cache[instance_index(info)][bank] & (1 << bankpin));
 
 			break;
 		}
@@ -431,3 +567,44 @@ iram io_error_t io_mcp_write_pin(string_t *error_message, const struct io_info_e
 
 	return(io_ok);
 }
+
+iram io_error_t io_mcp_write_mask(string_t *error_message, const struct io_info_entry_T *info, unsigned int mask, unsigned int values)
+{
+	uint8_t *cache = pin_output_cache[instance_index(info)];
+	int bank, first, last;
+
+	for(bank = 0; bank < 2; bank++)
+	{
+		cache[bank] &= ~(mask >> (bank * 8));
+		cache[bank] |= (values & mask) >> (bank * 8);
+	}
+
+	// OLATA and OLATB are adjacent, write both in one transaction if needed
+
+	first = (mask & 0x00ff) ? 0 : 1;
+	last = (mask & 0xff00) ? 1 : 0;
+
+	if(first > last)
+		return(io_ok);
+
+	return(write_registers(error_message, info->address, OLAT(first), last - first + 1, &cache[first]));
+}
+
+iram io_error_t io_mcp_read_port(string_t *error_message, const struct io_info_entry_T *info, unsigned int *values)
+{
+	const uint8_t *input = pin_input_cache[instance_index(info)];
+	const uint8_t *output = pin_output_cache[instance_index(info)];
+	const uint8_t *output_mask = pin_output_mask[instance_index(info)];
+	uint8_t port[2];
+	int bank;
+
+	// inputs from the last poll, outputs from the latch cache, reading
+	// GPIO here would clear INTF and INTCAP before io_mcp_periodic sees them
+
+	for(bank = 0; bank < 2; bank++)
+		port[bank] = (input[bank] & ~output_mask[bank]) | (output[bank] & output_mask[bank]);
+
+	*values = (port[1] << 8) | port[0];
+
+	return(io_ok);
+}
@@ -21,5 +21,7 @@ io_error_t	io_mcp_init_pin_mode(string_t *, const struct io_info_entry_T *, io_d
 io_error_t	io_mcp_get_pin_info(string_t *, const struct io_info_entry_T *, io_data_pin_entry_t *, const io_config_pin_entry_t *, int);
 io_error_t	io_mcp_read_pin(string_t *, const struct io_info_entry_T *, io_data_pin_entry_t *, const io_config_pin_entry_t *, int, int *);
 io_error_t	io_mcp_write_pin(string_t *, const struct io_info_entry_T *, io_data_pin_entry_t *, const io_config_pin_entry_t *, int, int);
+io_error_t	io_mcp_write_mask(string_t *, const struct io_info_entry_T *, unsigned int, unsigned int);
+io_error_t	io_mcp_read_port(string_t *, const struct io_info_entry_T *, unsigned int *);
 
 #endif
@@ -6,13 +6,33 @@
 
 #include <stdlib.h>
 
-static uint8 pcf_data_pin_table[io_pcf_instance_size];
+// writes only update the shadow byte, it's sent to the device once
+// by io_pcf_flush at the end of the periodic tick (queued, not waited
+// for) or command (which reports a failure to the client), reads
+// sample the port once and are served from it until the next flush
+
+typedef struct
+{
+	uint8_t output;
+	uint8_t input;
+	uint8_t queued_output;		// buffer of the queued write
+	unsigned int dirty:1;
+	unsigned int sampled:1;
+	unsigned int queued:1;
+} pcf_data_t;
+
+static pcf_data_t pcf_data[io_pcf_instance_size];
 
 irom io_error_t io_pcf_init(const struct io_info_entry_T *info)
 {
 	uint8_t i2cbuffer[1];
 
-	pcf_data_pin_table[info->instance] = 0x00;
+	pcf_data[info->instance].output = 0x00;
+	pcf_data[info->instance].dirty = 0;
+	pcf_data[info->instance].sampled = 0;
+	pcf_data[info->instance].queued = 0;
+
+	i2c_set_device(info->address, i2c_priority_high, false);
 
 	if(i2c_receive(info->address, 1, i2cbuffer) != i2c_error_ok)
 		return(io_error);
@@ -22,7 +42,7 @@ irom io_error_t io_pcf_init(const struct io_info_entry_T *info)
 
 irom io_error_t io_pcf_init_pin_mode(string_t *error_message, const struct io_info_entry_T *info, io_data_pin_entry_t *pin_data, const io_config_pin_entry_t *pin_config, int pin)
 {
-	uint8_t *pcf_pin_data = &pcf_data_pin_table[info->instance];
+	pcf_data_t *pcf_pin_data = &pcf_data[info->instance];
 	i2c_error_t error;
 
 	switch(pin_config->llmode)
@@ -61,13 +81,83 @@ irom io_error_t io_pcf_init_pin_mode(string_t *error_message, const struct io_in
 		}
 	}
 
-	*pcf_pin_data = *pcf_pin_data & ~(1 << pin);
+	pcf_pin_data->output &= ~(1 << pin);
+	pcf_pin_data->sampled = 0;
+
+	return(io_ok);
+}
+
+irom static void pcf_flush_callback(const i2c_transaction_t *transaction)
+{
+	pcf_data_t *pcf_pin_data = (pcf_data_t *)transaction->context;
+
+	pcf_pin_data->queued = 0;
+
+	// a write since it was queued keeps it dirty for the next flush
+
+	if((transaction->error == i2c_error_ok) && (pcf_pin_data->output == pcf_pin_data->queued_output))
+		pcf_pin_data->dirty = 0;
+}
+
+irom static void pcf_flush_queue(const struct io_info_entry_T *info, pcf_data_t *pcf_pin_data)
+{
+	i2c_transaction_t transaction;
+
+	pcf_pin_data->queued_output = pcf_pin_data->output;
+
+	transaction.address = info->address;
+	transaction.bus = 0;
+	transaction.priority = i2c_priority_high;
+	transaction.reg = -1;
+	transaction.send_length = 1;
+	transaction.send = &pcf_pin_data->queued_output;
+	transaction.receive_length = 0;
+	transaction.receive = (uint8_t *)0;
+	transaction.stop = true;
+	transaction.callback = pcf_flush_callback;
+	transaction.context = pcf_pin_data;
+
+	if(i2c_queue(&transaction) == i2c_error_ok)
+		pcf_pin_data->queued = 1;
+}
+
+irom io_error_t io_pcf_flush(string_t *error_message, const struct io_info_entry_T *info, bool_t wait)
+{
+	pcf_data_t *pcf_pin_data = &pcf_data[info->instance];
+	i2c_error_t error;
+
+	pcf_pin_data->sampled = 0;
+
+	if(!pcf_pin_data->dirty)
+		return(io_ok);
+
+	// one queued write at a time, later changes go with the next flush
+
+	if(!wait)
+	{
+		if(!pcf_pin_data->queued)
+			pcf_flush_queue(info, pcf_pin_data);
+
+		return(io_ok);
+	}
+
+	// keep the write pending when it fails, so the next flush retries it
+
+	if((error = i2c_send_1(info->address, pcf_pin_data->output)) != i2c_error_ok)
+	{
+		if(error_message)
+			i2c_error_format_string(error_message, error);
+		return(io_error);
+	}
+
+	pcf_pin_data->dirty = 0;
 
 	return(io_ok);
 }
 
 irom io_error_t io_pcf_read_pin(string_t *error_message, const struct io_info_entry_T *info, io_data_pin_entry_t *pin_data, const io_config_pin_entry_t *pin_config, int pin, int *value)
 {
+	pcf_data_t *pcf_pin_data = &pcf_data[info->instance];
 	uint8_t i2c_data[1];
 	i2c_error_t error;
 
@@ -76,10 +166,17 @@ irom io_error_t io_pcf_read_pin(string_t *error_message, const struct io_info_en
 		case(io_pin_ll_input_digital):
 		case(io_pin_ll_output_digital):
 		{
-			if((error = i2c_receive(info->address, 1, i2c_data)) != i2c_error_ok)
+			if(!pcf_pin_data->sampled)
 			{
-				i2c_error_format_string(error_message, error);
-				return(io_error);
+				if((error = i2c_receive(info->address, 1, i2c_data)) != i2c_error_ok)
+				{
+					if(error_message)
+						i2c_error_format_string(error_message, error);
+					return(io_error);
+				}
+
+				pcf_pin_data->input = i2c_data[0];
+				pcf_pin_data->sampled = 1;
 			}
 
 			break;
@@ -94,30 +191,30 @@ irom io_error_t io_pcf_read_pin(string_t *error_message, const struct io_info_en
 		}
 	}
 
-	*value = !!(i2c_data[0] & (1 << pin));
+	// an output with a pending write reads back its new state
+
+	if((pin_config->llmode == io_pin_ll_output_digital) && pcf_pin_data->dirty)
+		*value = !!(pcf_pin_data->output & (1 << pin));
+	else
+		*value = !!(pcf_pin_data->input & (1 << pin));
 
 	return(io_ok);
 }
 
 irom io_error_t io_pcf_write_pin(string_t *error_message, const struct io_info_entry_T *info, io_data_pin_entry_t *pin_data, const io_config_pin_entry_t *pin_config, int pin, int value)
 {
-	i2c_error_t error;
-	uint8_t *pcf_pin_data = &pcf_data_pin_table[info->instance];
+	pcf_data_t *pcf_pin_data = &pcf_data[info->instance];
 
 	switch(pin_config->llmode)
 	{
 		case(io_pin_ll_output_digital):
 		{
 			if(value)
-				*pcf_pin_data = *pcf_pin_data |  (1 << pin);
+				pcf_pin_data->output |= 1 << pin;
 			else
-				*pcf_pin_data = *pcf_pin_data & ~(1 << pin);
-			
-			if((error = i2c_send_1(info->address, *pcf_pin_data)) != i2c_error_ok)
-			{
-				i2c_error_format_string(error_message, error);
-				return(io_error);
-			}
+				pcf_pin_data->output &= ~(1 << pin);
+
+			pcf_pin_data->dirty = 1;
 
 			break;
 		}
@@ -133,3 +230,42 @@ irom io_error_t io_pcf_write_pin(string_t *error_message, const struct io_info_e
 
 	return(io_ok);
 }
+
+irom io_error_t io_pcf_write_mask(string_t *error_message, const struct io_info_entry_T *info, unsigned int mask, unsigned int values)
+{
+	pcf_data_t *pcf_pin_data = &pcf_data[info->instance];
+
+	pcf_pin_data->output = (pcf_pin_data->output & ~mask) | (values & mask);
+	pcf_pin_data->dirty = 1;
+
+	return(io_ok);
+}
+
+irom io_error_t io_pcf_read_port(string_t *error_message, const struct io_info_entry_T *info, unsigned int *values)
+{
+	pcf_data_t *pcf_pin_data = &pcf_data[info->instance];
+	uint8_t i2c_data[1];
+	i2c_error_t error;
+
+	// write pending output first, so the sample reflects it
+
+	if(pcf_pin_data->dirty && (io_pcf_flush(error_message, info, true) != io_ok))
+		return(io_error);
+
+	if(!pcf_pin_data->sampled)
+	{
+		if((error = i2c_receive(info->address, 1, i2c_data)) != i2c_error_ok)
+		{
+			if(error_message)
+				i2c_error_format_string(error_message, error);
+			return(io_error);
+		}
+
+		pcf_pin_data->input = i2c_data[0];
+		pcf_pin_data->sampled = 1;
+	}
+
+	*values = pcf_pin_data->input;
+
+	return(io_ok);
+}
@@ -16,5 +16,8 @@ io_error_t	io_pcf_init(const struct io_info_entry_T *);
 io_error_t	io_pcf_init_pin_mode(string_t *, const struct io_info_entry_T *, io_data_pin_entry_t *, const io_config_pin_entry_t *, int);
 io_error_t	io_pcf_read_pin(string_t *, const struct io_info_entry_T *, io_data_pin_entry_t *, const io_config_pin_entry_t *, int, int *);
 io_error_t	io_pcf_write_pin(string_t *, const struct io_info_entry_T *, io_data_pin_entry_t *, const io_config_pin_entry_t *, int, int);
+io_error_t	io_pcf_write_mask(string_t *, const struct io_info_entry_T *, unsigned int, unsigned int);
+io_error_t	io_pcf_read_port(string_t *, const struct io_info_entry_T *, unsigned int *);
+io_error_t	io_pcf_flush(string_t *, const struct io_info_entry_T *, bool_t wait);
 
 #endif
@@ -0,0 +1,283 @@
+#include "modbus.h"
+
+#include "util.h"
+#include "stats.h"
+#include "queue.h"
+#include "uart.h"
+#include "user_main.h"
+
+#include <user_interface.h>
+
+// Modbus TCP <-> Modbus RTU gateway
+//
+// Requests from the network (MBAP header + PDU) are queued and sent
+// one at a time over the uart as RTU frames (unit id + PDU + CRC16).
+// The end of the RTU response is detected by the inter-character gap
+// (see uart_set_rx_gap), it's then returned to the client that sent the
+// request, with the original MBAP transaction id.
+
+enum
+{
+	modbus_queue_size = 4,
+	modbus_pdu_size = 253,
+	modbus_mbap_size = 6,
+	modbus_response_timeout_us = 1000000,
+	modbus_broadcast_delay_us = 100000,
+	modbus_exception_flag = 0x80,
+	modbus_exception_target_failed = 0x0b,
+};
+
+typedef struct
+{
+	socket_remote_t	remote;
+	uint16_t		transaction;
+	uint8_t			unit;
+	uint8_t			length;
+	uint8_t			pdu[modbus_pdu_size];
+} modbus_transaction_t;
+
+static modbus_transaction_t modbus_queue[modbus_queue_size];
+static int modbus_queue_in = 0;
+static int modbus_queue_out = 0;
+static bool_t modbus_active = false;
+static uint32_t modbus_active_since;
+
+irom attr_pure static uint16_t modbus_crc16(uint16_t crc, int length, const uint8_t *data)
+{
+	int bit;
+
+	while(length-- > 0)
+	{
+		crc ^= *data++;
+
+		for(bit = 0; bit < 8; bit++)
+		{
+			if(crc & 0x0001)
+				crc = (crc >> 1) ^ 0xa001;
+			else
+				crc = crc >> 1;
+		}
+	}
+
+	return(crc);
+}
+
+always_inline static uint8_t modbus_byte_at(const string_t *src, int offset)
+{
+	return((uint8_t)string_at(src, offset));
+}
+
+irom static void modbus_mbap_header(char *buffer, const modbus_transaction_t *entry, int length)
+{
+	buffer[0] = (entry->transaction >> 8) & 0xff;
+	buffer[1] = (entry->transaction >> 0) & 0xff;
+	buffer[2] = 0x00;
+	buffer[3] = 0x00;
+	buffer[4] = ((length + 1) >> 8) & 0xff;
+	buffer[5] = ((length + 1) >> 0) & 0xff;
+	buffer[6] = entry->unit;
+}
+
+irom static void modbus_send_byte(uint8_t byte)
+{
+	if(queue_full(&uart_send_queue))
+		stat_uart_receive_buffer_overflow++;
+	else
+		queue_push(&uart_send_queue, byte);
+}
+
+irom static void modbus_complete(void)
+{
+	modbus_queue_out = (modbus_queue_out + 1) % modbus_queue_size;
+	modbus_active = false;
+}
+
+irom void modbus_disconnect(void)
+{
+	int ix;
+
+	// responses for tcp requests can't be delivered anymore, the tcp
+	// child socket is gone, the transactions will be run anyway but
+	// their responses are dropped
+
+	for(ix = 0; ix < modbus_queue_size; ix++)
+		if(modbus_queue[ix].remote.proto == proto_tcp)
+			modbus_queue[ix].remote.proto = proto_none;
+}
+
+irom void modbus_request(const socket_t *socket, const string_t *src)
+{
+	modbus_transaction_t *entry;
+	int offset, length, protocol, next;
+
+	// a tcp segment may contain more than one request, queue them all
+
+	for(offset = 0; (offset + modbus_mbap_size) < string_length(src); offset += modbus_mbap_size + length)
+	{
+		protocol =	(modbus_byte_at(src, offset + 2) << 8) | modbus_byte_at(src, offset + 3);
+		length =	(modbus_byte_at(src, offset + 4) << 8) | modbus_byte_at(src, offset + 5);
+
+		if((protocol != 0) || (length < 2) || (length > (modbus_pdu_size + 1)) ||
+				((offset + modbus_mbap_size + length) > string_length(src)))
+		{
+			stat_modbus_invalid++;
+			return;
+		}
+
+		next = (modbus_queue_in + 1) % modbus_queue_size;
+
+		if(next == modbus_queue_out)
+		{
+			stat_modbus_overflow++;
+			continue;
+		}
+
+		entry = &modbus_queue[modbus_queue_in];
+
+		entry->remote = socket->remote;
+		entry->transaction = (modbus_byte_at(src, offset + 0) << 8) | modbus_byte_at(src, offset + 1);
+		entry->unit = modbus_byte_at(src, offset + modbus_mbap_size);
+		entry->length = length - 1;
+		memcpy(entry->pdu, string_buffer(src) + offset + modbus_mbap_size + 1, entry->length);
+
+		modbus_queue_in = next;
+		stat_modbus_requests++;
+	}
+}
+
+irom void modbus_transmit(void)
+{
+	const modbus_transaction_t *entry;
+	uint16_t crc;
+	int ix;
+
+	if(modbus_active || (modbus_queue_in == modbus_queue_out))
+		return;
+
+	entry = &modbus_queue[modbus_queue_out];
+
+	// a late response to an expired request must not be taken for the
+	// response to this one
+
+	uart_rx_flush();
+
+	crc = modbus_crc16(0xffff, 1, &entry->unit);
+	crc = modbus_crc16(crc, entry->length, entry->pdu);
+
+	modbus_send_byte(entry->unit);
+
+	for(ix = 0; ix < entry->length; ix++)
+		modbus_send_byte(entry->pdu[ix]);
+
+	modbus_send_byte((crc >> 0) & 0xff);
+	modbus_send_byte((crc >> 8) & 0xff);
+
+	modbus_active = true;
+	modbus_active_since = system_get_time();
+
+	uart_start_transmit(true);
+}
+
+irom bool_t modbus_response(string_t *frame, socket_t *socket)
+{
+	const modbus_transaction_t *entry;
+	int length;
+	uint16_t crc;
+	char *buffer;
+
+	length = string_length(frame);
+	buffer = string_buffer_nonconst(frame);
+
+	if(!modbus_active)
+	{
+		stat_modbus_invalid++;
+		return(false);
+	}
+
+	entry = &modbus_queue[modbus_queue_out];
+
+	if(length < 4)
+	{
+		stat_modbus_invalid++;
+		return(false);
+	}
+
+	crc = modbus_crc16(0xffff, length - 2, (const uint8_t *)buffer);
+
+	if((modbus_byte_at(frame, length - 2) != ((crc >> 0) & 0xff)) ||
+			(modbus_byte_at(frame, length - 1) != ((crc >> 8) & 0xff)))
+	{
+		stat_modbus_crc_errors++;
+		return(false);
+	}
+
+	if((modbus_byte_at(frame, 0) != entry->unit) ||
+			((modbus_byte_at(frame, 1) & ~modbus_exception_flag) != entry->pdu[0]))
+	{
+		stat_modbus_invalid++;
+		return(false);
+	}
+
+	// replace unit id and CRC by the MBAP header (which includes the unit id)
+
+	length -= 3;
+
+	if((length + modbus_mbap_size + 1) > string_size(frame))
+	{
+		stat_modbus_invalid++;
+		return(false);
+	}
+
+	memmove(buffer + modbus_mbap_size + 1, buffer + 1, length);
+	modbus_mbap_header(buffer, entry, length);
+	string_setlength(frame, modbus_mbap_size + 1 + length);
+
+	socket->remote = entry->remote;
+
+	modbus_complete();
+	stat_modbus_responses++;
+
+	return(socket->remote.proto != proto_none);
+}
+
+irom bool_t modbus_timeout(string_t *dst, socket_t *socket)
+{
+	const modbus_transaction_t *entry;
+	uint32_t elapsed;
+	char *buffer;
+
+	if(!modbus_active)
+		return(false);
+
+	entry = &modbus_queue[modbus_queue_out];
+	elapsed = system_get_time() - modbus_active_since;
+
+	// broadcast requests don't get a response
+
+	if(entry->unit == 0)
+	{
+		if(elapsed >= modbus_broadcast_delay_us)
+			modbus_complete();
+
+		return(false);
+	}
+
+	if(elapsed < modbus_response_timeout_us)
+		return(false);
+
+	stat_modbus_timeouts++;
+
+	// reply with a "gateway target device failed to respond" exception
+
+	buffer = string_buffer_nonconst(dst);
+	modbus_mbap_header(buffer, entry, 2);
+	buffer[modbus_mbap_size + 1] = entry->pdu[0] | modbus_exception_flag;
+	buffer[modbus_mbap_size + 2] = modbus_exception_target_failed;
+	string_setlength(dst, modbus_mbap_size + 3);
+
+	socket->remote = entry->remote;
+
+	modbus_complete();
+
+	return(socket->remote.proto != proto_none);
+}
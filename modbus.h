@@ -0,0 +1,12 @@
+#ifndef modbus_h
+#define modbus_h
+
+#include "util.h"
+#include "socket.h"
+
+void	modbus_disconnect(void);
+void	modbus_request(const socket_t *socket, const string_t *src);
+void	modbus_transmit(void);
+bool_t	modbus_response(string_t *frame, socket_t *socket);
+bool_t	modbus_timeout(string_t *dst, socket_t *socket);
+#endif
@@ -0,0 +1,284 @@
+#include "notify.h"
+
+#include "io.h"
+#include "config.h"
+#include "socket.h"
+#include "stats.h"
+#include "util.h"
+
+#include <user_interface.h>
+
+// Pin change notifications
+//
+// A client subscribes with an address, port, lease time and a set of pins
+// for one or more io's. Events from the io journal for these pins are sent
+// to the client as udp datagrams, all events within the coalescing window
+// are sent in one datagram. A subscription that isn't renewed before the
+// lease time runs out is dropped.
+
+enum
+{
+	notify_subscribers = 4,
+	notify_tick_ms = 10,
+	notify_port_default = 26,
+	notify_window_default_ms = 50,
+	notify_lease_max_s = 3600,
+};
+
+typedef struct
+{
+	socket_remote_t	remote;
+	uint16_t		pins[io_id_size];
+	uint32_t		cursor;
+	unsigned int	lease_ticks;	// 0 = slot unused
+	unsigned int	window_ticks;	// 0 = nothing pending
+} notify_subscriber_t;
+
+static notify_subscriber_t notify_subscriber[notify_subscribers];
+static socket_t notify_socket;
+static unsigned int notify_window_ticks;
+
+string_new(static, notify_buffer, 512);
+
+irom void notify_init(void)
+{
+	int port, window;
+	string_init(varname_notify_port, "notify.port");
+	string_init(varname_notify_window, "notify.window");
+
+	if(!config_get_int(&varname_notify_port, -1, -1, &port))
+		port = notify_port_default;
+
+	if(!config_get_int(&varname_notify_window, -1, -1, &window))
+		window = notify_window_default_ms;
+
+	notify_window_ticks = (window + notify_tick_ms - 1) / notify_tick_ms;
+
+	if(notify_window_ticks < 1)
+		notify_window_ticks = 1;
+
+	socket_create(false, true, &notify_socket, port, 0,
+			(void *)0, (void *)0, (void *)0, (void *)0, (void *)0, (void *)0);
+}
+
+irom static bool_t notify_subscribed(const notify_subscriber_t *subscriber, const io_journal_entry_t *entry)
+{
+	return((entry->io < io_id_size) && (subscriber->pins[entry->io] & (1 << entry->pin)));
+}
+
+irom static void notify_send(notify_subscriber_t *subscriber, uint32_t sequence)
+{
+	io_journal_entry_t entry;
+
+	string_clear(&notify_buffer);
+	string_format(&notify_buffer, "pc %u", subscriber->cursor);
+
+	for(; subscriber->cursor != sequence; subscriber->cursor++)
+	{
+		if(!io_journal_get(subscriber->cursor, &entry))
+			continue;
+
+		if(!notify_subscribed(subscriber, &entry))
+			continue;
+
+		if((string_length(&notify_buffer) + 24) > string_size(&notify_buffer))
+		{
+			// send the rest with the next tick
+
+			subscriber->window_ticks = 1;
+			break;
+		}
+
+		string_format(&notify_buffer, " %u/%u=%d", entry.io, entry.pin, entry.new_value);
+	}
+
+	string_append(&notify_buffer, "\n");
+
+	notify_socket.remote = subscriber->remote;
+
+	if(socket_send(&notify_socket, &notify_buffer))
+		stat_notify_sent++;
+	else
+		stat_notify_failed++;
+}
+
+irom void notify_periodic(void)
+{
+	notify_subscriber_t *subscriber;
+	io_journal_entry_t entry;
+	uint32_t sequence, cursor, drained;
+	unsigned int ix;
+	bool_t active;
+
+	sequence = io_journal_sequence();
+
+	for(ix = 0; ix < notify_subscribers; ix++)
+	{
+		subscriber = &notify_subscriber[ix];
+
+		if(subscriber->lease_ticks == 0)
+			continue;
+
+		if(--subscriber->lease_ticks == 0)
+		{
+			stat_notify_expired++;
+			continue;
+		}
+
+		if(subscriber->window_ticks == 0)
+		{
+			// start the coalescing window at the first event for one of the subscribed pins
+
+			for(cursor = subscriber->cursor; cursor != sequence; cursor++)
+				if(io_journal_get(cursor, &entry) && notify_subscribed(subscriber, &entry))
+					break;
+
+			subscriber->cursor = cursor;
+
+			if(cursor != sequence)
+				subscriber->window_ticks = notify_window_ticks;
+
+			continue;
+		}
+
+		if(--subscriber->window_ticks > 0)
+			continue;
+
+		// the socket is shared by all subscribers, try again next tick if it's busy
+
+		if(notify_socket.send_busy)
+		{
+			subscriber->window_ticks = 1;
+			continue;
+		}
+
+		notify_send(subscriber, sequence);
+	}
+
+	// events all subscribers have been sent (or weren't interested in) are
+	// drained, so they don't count as lost when they're overwritten
+
+	for(ix = 0, drained = sequence, active = false; ix < notify_subscribers; ix++)
+	{
+		subscriber = &notify_subscriber[ix];
+
+		if(subscriber->lease_ticks == 0)
+			continue;
+
+		active = true;
+
+		if((int32_t)(subscriber->cursor - drained) < 0)
+			drained = subscriber->cursor;
+	}
+
+	if(active)
+		io_journal_drain(drained);
+}
+
+irom app_action_t application_function_notify_subscribe(const string_t *src, string_t *dst)
+{
+	notify_subscriber_t *subscriber;
+	ip_addr_to_bytes_t a2b;
+	int port, lease, io, mask, ix, parameter;
+	string_new(stack, ip, 32);
+
+	if(parse_string(1, src, &ip, ' ') != parse_ok)
+	{
+		for(ix = 0; ix < notify_subscribers; ix++)
+		{
+			subscriber = &notify_subscriber[ix];
+
+			if(subscriber->lease_ticks == 0)
+				continue;
+
+			string_format(dst, "> %d: ", ix);
+			string_ip(dst, subscriber->remote.address.ip_addr);
+			string_format(dst, ":%d, lease: %u s, pins:", subscriber->remote.port, subscriber->lease_ticks / (1000 / notify_tick_ms));
+
+			for(io = 0; io < io_id_size; io++)
+				if(subscriber->pins[io])
+					string_format(dst, " %d:0x%04x", io, subscriber->pins[io]);
+
+			string_append(dst, "\n");
+		}
+
+		return(app_action_normal);
+	}
+
+	if((parse_int(2, src, &port, 0, ' ') != parse_ok) || (parse_int(3, src, &lease, 0, ' ') != parse_ok))
+	{
+		string_append(dst, "notify-subscribe <ip> <port> <lease s> [<io> <pin mask>]...\n");
+		return(app_action_error);
+	}
+
+	if((port < 1) || (port > 65535) || (lease < 0) || (lease > notify_lease_max_s))
+	{
+		string_format(dst, "notify-subscribe: port must be 1-65535, lease 0-%d s\n", notify_lease_max_s);
+		return(app_action_error);
+	}
+
+	a2b.ip_addr = ip_addr(string_to_cstr(&ip));
+
+	// renew an existing subscription for this client or take a free slot
+
+	for(ix = 0; ix < notify_subscribers; ix++)
+	{
+		subscriber = &notify_subscriber[ix];
+
+		if((subscriber->lease_ticks > 0) && (subscriber->remote.port == port) &&
+				(subscriber->remote.address.ip_addr.addr == a2b.ip_addr.addr))
+			break;
+	}
+
+	if(ix >= notify_subscribers)
+	{
+		if(lease == 0)
+		{
+			string_append(dst, "notify-subscribe: not subscribed\n");
+			return(app_action_error);
+		}
+
+		for(ix = 0; ix < notify_subscribers; ix++)
+			if(notify_subscriber[ix].lease_ticks == 0)
+				break;
+
+		if(ix >= notify_subscribers)
+		{
+			string_append(dst, "notify-subscribe: no free slots\n");
+			return(app_action_error);
+		}
+
+		subscriber = &notify_subscriber[ix];
+		subscriber->remote.proto = proto_udp;
+		subscriber->remote.port = port;
+		subscriber->remote.address = a2b;
+		subscriber->cursor = io_journal_sequence();
+		subscriber->window_ticks = 0;
+
+		for(io = 0; io < io_id_size; io++)
+			subscriber->pins[io] = 0;
+	}
+
+	subscriber->lease_ticks = lease * (1000 / notify_tick_ms);
+
+	if(lease == 0)
+	{
+		string_append(dst, "notify-subscribe: unsubscribed\n");
+		return(app_action_normal);
+	}
+
+	for(parameter = 4; parse_int(parameter, src, &io, 0, ' ') == parse_ok; parameter += 2)
+	{
+		if((io < 0) || (io >= io_id_size) || (parse_int(parameter + 1, src, &mask, 0, ' ') != parse_ok))
+		{
+			string_append(dst, "notify-subscribe: invalid <io> <pin mask>\n");
+			return(app_action_error);
+		}
+
+		subscriber->pins[io] = mask & 0xffff;
+	}
+
+	string_format(dst, "notify-subscribe: subscription %d, lease %d s\n", ix, lease);
+
+	return(app_action_normal);
+}
@@ -0,0 +1,10 @@
+#ifndef notify_h
+#define notify_h
+
+#include "util.h"
+#include "application.h"
+
+void			notify_init(void);
+void			notify_periodic(void);
+app_action_t	application_function_notify_subscribe(const string_t *src, string_t *dst);
+#endif
@@ -0,0 +1,255 @@
+#include "pwm.h"
+
+#include "util.h"
+
+// merging channels with a nearly equal duty ends the later one up to
+// min gap ticks early, the gap is absolute, so it's limited to a fraction
+// of the period, to keep the error below ~1.6% of full scale for short
+// periods too
+
+irom attr_const unsigned int pwm_min_gap_limit(unsigned int period, unsigned int min_gap)
+{
+	if(min_gap > (period / pwm_min_gap_period_fraction))
+		min_gap = period / pwm_min_gap_period_fraction;
+
+	return(min_gap);
+}
+
+// staggered mode, every channel switches on at its own offset within the
+// period, the set and clear edges of all channels are merged into one
+// list sorted by time, phase 0 sets the state of all channels at the
+// start of the period, so a new phase set takes over without glitches
+
+typedef struct
+{
+	uint16_t	time;
+	uint16_t	set_mask;
+	uint16_t	clear_mask;
+} pwm_edge_t;
+
+irom static void pwm_phases_staggered(pwm_phases_t *phase_data, const pwm_channels_t *channels, uint32_t analog_mask,
+		unsigned int length, unsigned int min_gap, unsigned int dither_bits, const unsigned int *duty)
+{
+	pwm_edge_t edge[pwm_max_channels * 2], this;
+	pwm_phase_t *phase;
+	unsigned int current, next, edges, analog, rank, offset, ticks, end;
+	int pin;
+
+	for(pin = 0, analog = 0; pin < pwm_max_channels; pin++)
+		if(analog_mask & (1 << pin))
+			analog++;
+
+	for(current = 0, edges = 0; current < channels->size; current++)
+	{
+		pin = channels->pin[current];
+
+		// the offset depends on the position among all analog outputs,
+		// not on the duty, so it doesn't move when the duty changes
+
+		for(next = 0, rank = 0; (int)next < pin; next++)
+			if(analog_mask & (1 << next))
+				rank++;
+
+		offset = (rank * length) / analog;
+		ticks = duty[pin] >> dither_bits;
+
+		if(ticks == 0)
+			ticks = 1;
+
+		end = offset + ticks;
+
+		if((offset == 0) || (end > length))
+			phase_data->phase[0].set_mask |= 1 << pin;
+		else
+			phase_data->phase[0].clear_mask |= 1 << pin;
+
+		if(end >= length)
+			end -= length;
+
+		if(offset != 0)
+		{
+			edge[edges].time = offset;
+			edge[edges].set_mask = 1 << pin;
+			edge[edges].clear_mask = 0x0000;
+			edges++;
+		}
+
+		if(end != 0)
+		{
+			edge[edges].time = end;
+			edge[edges].set_mask = 0x0000;
+			edge[edges].clear_mask = 1 << pin;
+			edges++;
+		}
+	}
+
+	for(current = 1; current < edges; current++)
+	{
+		this = edge[current];
+
+		for(next = current; (next > 0) && (edge[next - 1].time > this.time); next--)
+			edge[next] = edge[next - 1];
+
+		edge[next] = this;
+	}
+
+	// edges within min gap of the previous phase are merged into it,
+	// unless the phase already switches the same channel
+
+	for(current = 0; current < edges; current++)
+	{
+		phase = &phase_data->phase[phase_data->size - 1];
+
+		if(((unsigned int)(edge[current].time - phase->duty) < min_gap) &&
+				!((phase->set_mask | phase->clear_mask) & (edge[current].set_mask | edge[current].clear_mask)))
+		{
+			phase->set_mask |= edge[current].set_mask;
+			phase->clear_mask |= edge[current].clear_mask;
+			continue;
+		}
+
+		phase = &phase_data->phase[phase_data->size++];
+		phase->duty = edge[current].time;
+		phase->set_mask = edge[current].set_mask;
+		phase->clear_mask = edge[current].clear_mask;
+		phase->dither = 0x0000;
+	}
+
+	for(current = 0; current < phase_data->size; current++)
+	{
+		phase = &phase_data->phase[current];
+
+		if((current + 1) < phase_data->size)
+			phase->delay = phase_data->phase[current + 1].duty - phase->duty;
+		else
+			phase->delay = length - phase->duty;
+	}
+}
+
+// build the phase table for the analog outputs in analog_mask, the duty
+// of each pin is in units of 1 / 2^dither_bits tick and must be below
+// period << dither_bits
+
+irom void pwm_phases_build(pwm_phases_t *phase_data, pwm_channels_t *channels, const pwm_setup_t *setup,
+		uint32_t analog_mask, const unsigned int duty[pwm_max_channels])
+{
+	unsigned int current, next, size, ticks, fraction, frame, delta, previous, dither_bits;
+	uint32_t pin_mask;
+	int pin;
+
+	dither_bits = setup->dither_bits;
+
+	phase_data->init_clear_mask = 0;
+	phase_data->init_set_mask = 0;
+	phase_data->dither = 0;
+
+	// fully off and fully on channels don't need a phase
+
+	for(pin = 0, pin_mask = 0; pin < pwm_max_channels; pin++)
+	{
+		if(!(analog_mask & (1 << pin)))
+			continue;
+
+		if(duty[pin] == 0)
+			phase_data->init_clear_mask |= 1 << pin;
+		else
+			if(((duty[pin] >> dither_bits) + 1) >= setup->period)
+				phase_data->init_set_mask |= 1 << pin;
+			else
+				pin_mask |= 1 << pin;
+	}
+
+	// collect the channels that need a phase, keep the order of the
+	// previous run first, so the insertion sort below only moves the
+	// channels whose duty has changed
+
+	for(current = 0, size = 0; current < channels->size; current++)
+	{
+		pin = channels->pin[current];
+
+		if(pin_mask & (1 << pin))
+		{
+			channels->pin[size++] = pin;
+			pin_mask &= ~(1 << pin);
+		}
+	}
+
+	for(pin = 0; pin_mask != 0; pin++, pin_mask >>= 1)
+		if(pin_mask & 0x01)
+			channels->pin[size++] = pin;
+
+	channels->size = size;
+
+	for(current = 1; current < channels->size; current++)
+	{
+		pin = channels->pin[current];
+
+		for(next = current; (next > 0) && (duty[channels->pin[next - 1]] > duty[pin]); next--)
+			channels->pin[next] = channels->pin[next - 1];
+
+		channels->pin[next] = pin;
+	}
+
+	// emit the phases, in order of duty
+
+	phase_data->phase[0].duty = 0;
+	phase_data->phase[0].delay = 0;
+	phase_data->phase[0].set_mask = 0x0000;
+	phase_data->phase[0].clear_mask = 0x0000;
+	phase_data->phase[0].dither = 0x0000;
+	phase_data->size = 1;
+
+	if(setup->stagger)
+		pwm_phases_staggered(phase_data, channels, analog_mask, setup->period - 1, setup->min_gap, dither_bits, duty);
+
+	for(current = 0, previous = 0; !setup->stagger && (current < channels->size); current++)
+	{
+		pin = channels->pin[current];
+
+		phase_data->phase[0].set_mask |= 1 << pin;
+
+		ticks = duty[pin] >> dither_bits;
+		fraction = (duty[pin] & ((1 << dither_bits) - 1)) << (pwm_dither_bits_max - dither_bits);
+
+		// a phase can't be at tick 0, that's where all channels are switched on
+
+		if(ticks == 0)
+		{
+			ticks = 1;
+			fraction = 0;
+		}
+
+		delta = ticks - previous;
+
+		// channels with (nearly) the same duty share one phase, so the
+		// number of isr invocations per period stays bounded, the later
+		// channel is switched off up to min gap early
+
+		if((delta != 0) && ((delta >= setup->min_gap) || (phase_data->size < 2)))
+		{
+			previous = ticks;
+			phase_data->phase[phase_data->size - 1].delay	= delta;
+			phase_data->phase[phase_data->size].duty		= ticks;
+			phase_data->phase[phase_data->size].delay		= setup->period - 1 - ticks;
+			phase_data->phase[phase_data->size].set_mask	= 0x0000;
+			phase_data->phase[phase_data->size].clear_mask	= 1 << pin;
+			phase_data->phase[phase_data->size].dither		= 0x0000;
+
+			// first order error diffusion, the extra tick is spread evenly over the frames
+
+			for(frame = 0; frame < pwm_dither_frames; frame++)
+				if((((frame + 1) * fraction) >> pwm_dither_bits_max) != ((frame * fraction) >> pwm_dither_bits_max))
+					phase_data->phase[phase_data->size].dither |= 1 << frame;
+
+			if(phase_data->phase[phase_data->size].dither)
+				phase_data->dither = 1;
+
+			phase_data->size++;
+		}
+		else
+			phase_data->phase[phase_data->size - 1].clear_mask |= 1 << pin;
+	}
+
+	if(phase_data->size < 2)
+		phase_data->size = 0;
+}
@@ -0,0 +1,60 @@
+#ifndef pwm_h
+#define pwm_h
+
+#include "util.h"
+
+#include <stdint.h>
+
+// the pwm phase tables, run by the timer interrupt in io_gpio.c, building
+// them doesn't touch the hardware, so it can be tested on the host
+
+enum
+{
+	pwm_max_channels = 16,
+	pwm_max_phases = (pwm_max_channels * 2) + 1,
+	pwm_min_gap_default = 24,
+	pwm_min_gap_period_fraction = 64,
+	pwm_dither_bits_max = 4,
+	pwm_dither_frames = 1 << pwm_dither_bits_max,
+};
+
+typedef struct
+{
+	uint32_t	delay;
+	uint16_t	duty;		// time of the phase within the period
+	uint16_t	set_mask;
+	uint16_t	clear_mask;
+	uint16_t	dither;		// one bit per frame, edge is one tick later in these frames
+} pwm_phase_t;
+
+typedef struct
+{
+	unsigned int	size;
+	unsigned int	dither;
+	uint32_t		init_set_mask;
+	uint32_t		init_clear_mask;
+	pwm_phase_t		phase[pwm_max_phases];
+} pwm_phases_t;
+
+// channels that need a phase, sorted by duty, kept between builds, so
+// the sort only has to move the channels whose duty has changed
+
+typedef struct
+{
+	unsigned int	size;
+	uint8_t			pin[pwm_max_channels];
+} pwm_channels_t;
+
+typedef struct
+{
+	unsigned int	period;			// timer ticks
+	unsigned int	min_gap;		// timer ticks
+	unsigned int	dither_bits;
+	bool_t			stagger;
+} pwm_setup_t;
+
+unsigned int	pwm_min_gap_limit(unsigned int period, unsigned int min_gap);
+void			pwm_phases_build(pwm_phases_t *phase_data, pwm_channels_t *channels, const pwm_setup_t *setup,
+						uint32_t analog_mask, const unsigned int duty[pwm_max_channels]);
+
+#endif
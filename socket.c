@@ -3,7 +3,7 @@
 #include "stats.h"
 
 static unsigned int sockets_length = 0;
-static socket_t *sockets[2];
+static socket_t *sockets[3];
 
 iram static socket_t *find_socket(struct espconn *esp_socket)
 {
@@ -13,6 +13,13 @@ typedef enum
 	proto_both,
 } socket_proto_t;
 
+typedef struct
+{
+	socket_proto_t		proto;
+	int					port;
+	ip_addr_to_bytes_t	address;
+} socket_remote_t;
+
 typedef struct _socket_t
 {
 	struct
@@ -29,13 +36,7 @@ typedef struct _socket_t
 	} tcp;
 
 	bool_t			send_busy;
-
-	struct
-	{
-		socket_proto_t		proto;
-		int					port;
-		ip_addr_to_bytes_t	address;
-	} remote;
+	socket_remote_t	remote;
 
 	void (*callback_received)(struct _socket_t *, const string_t *, void *userdata);
 	void (*callback_sent)(struct _socket_t *, void *userdata);
@@ -4,6 +4,7 @@
 #include "config.h"
 #include "time.h"
 #include "i2c.h"
+#include "io_gpio.h"
 
 #include <c_types.h>
 #include <user_interface.h>
@@ -20,18 +21,53 @@ stat_called_t stat_called =
 
 int stat_uart_rx_interrupts;
 int stat_uart_tx_interrupts;
+int stat_gpio_interrupts;
 int stat_fast_timer;
 int stat_slow_timer;
 int stat_timer_interrupts;
 int stat_pwm_timer_interrupts;
 int stat_pwm_timer_interrupts_while_nmi_masked;
+int stat_pwm_isr_histogram[stat_pwm_histogram_size];
+int stat_pwm_jitter_histogram[stat_pwm_histogram_size];
+uint64_t stat_pwm_isr_cycles;
+uint64_t stat_pwm_busy_wait_cycles;
 int stat_pc_counts;
+int stat_mcp_i2c_saved;
+int stat_mcp_i2c_transactions;
+int stat_io_periodic_us;
+int stat_io_periodic_max_us;
+int stat_io_journal_overflow;
 int stat_i2c_init_time_us;
+int stat_i2c_transactions;
+int stat_i2c_queued;
+int stat_i2c_merged;
+int stat_i2c_wait_timeouts;
+unsigned int stat_i2c_queue_depth_total;
+unsigned int stat_i2c_queue_depth_max;
+uint64_t stat_i2c_wait_cycles;
+uint32_t stat_i2c_wait_max_cycles;
+int stat_i2c_select_requests;
+int stat_i2c_select_writes;
+uint64_t stat_i2c_busy_cycles;
+uint64_t stat_i2c_clock_cycles;
+unsigned int stat_i2c_clock_periods;
 int stat_display_init_time_us;
 int stat_cmd_receive_buffer_overflow;
 int stat_cmd_send_buffer_overflow;
 int stat_uart_receive_buffer_overflow;
 int stat_uart_send_buffer_overflow;
+int stat_uart_frames;
+int stat_uart_frames_oversize;
+int stat_uart_frame_errors;
+int stat_modbus_requests;
+int stat_modbus_responses;
+int stat_modbus_timeouts;
+int stat_modbus_crc_errors;
+int stat_modbus_invalid;
+int stat_modbus_overflow;
+int stat_notify_sent;
+int stat_notify_failed;
+int stat_notify_expired;
 
 int stat_update_uart;
 int stat_update_longop;
@@ -227,11 +263,15 @@ irom void stats_counters(string_t *dst)
 			"> user_rf_pre_init called: %s\n"
 			"> int uart rx: %u\n"
 			"> int uart tx: %u\n"
+			"> int gpio: %u\n"
 			"> fast timer fired: %u\n"
 			"> slow timer fired: %u\n"
 			"> pwm timer int fired: %u\n"
 			"> ... while masked: %u\n"
 			"> pc counts: %u\n"
+			"> mcp i2c polls skipped: %u\n"
+			"> io periodic time: %u us, max: %u us\n"
+			"> io journal events lost: %u\n"
 			"> uart updated: %u\n"
 			"> longops processed: %u\n"
 			"> commands/udp processed: %u\n"
@@ -242,16 +282,33 @@ irom void stats_counters(string_t *dst)
 			"> cmd receive buffer overflow events: %u\n"
 			"> cmd send buffer overflow events: %u\n"
 			"> uart receive buffer overflow events: %u\n"
-			"> uart send buffer overflow events: %u\n",
+			"> uart send buffer overflow events: %u\n"
+			"> uart frames received: %u\n"
+			"> uart oversize frames: %u\n"
+			"> uart framing errors: %u\n"
+			"> modbus requests: %u\n"
+			"> modbus responses: %u\n"
+			"> modbus timeouts: %u\n"
+			"> modbus crc errors: %u\n"
+			"> modbus invalid frames: %u\n"
+			"> modbus queue overflow: %u\n"
+			"> pin change notifications sent: %u\n"
+			"> pin change notifications failed: %u\n"
+			"> pin change subscriptions expired: %u\n",
 				yesno(stat_called.user_rf_cal_sector_set),
 				yesno(stat_called.user_rf_pre_init),
 				stat_uart_rx_interrupts,
 				stat_uart_tx_interrupts,
+				stat_gpio_interrupts,
 				stat_fast_timer,
 				stat_slow_timer,
 				stat_pwm_timer_interrupts,
 				stat_pwm_timer_interrupts_while_nmi_masked,
 				stat_pc_counts,
+				stat_mcp_i2c_saved,
+				stat_io_periodic_us,
+				stat_io_periodic_max_us,
+				stat_io_journal_overflow,
 				stat_update_uart,
 				stat_update_longop,
 				stat_update_command_udp,
@@ -262,26 +319,140 @@ irom void stats_counters(string_t *dst)
 				stat_cmd_receive_buffer_overflow,
 				stat_cmd_send_buffer_overflow,
 				stat_uart_receive_buffer_overflow,
-				stat_uart_send_buffer_overflow);
+				stat_uart_send_buffer_overflow,
+				stat_uart_frames,
+				stat_uart_frames_oversize,
+				stat_uart_frame_errors,
+				stat_modbus_requests,
+				stat_modbus_responses,
+				stat_modbus_timeouts,
+				stat_modbus_crc_errors,
+				stat_modbus_invalid,
+				stat_modbus_overflow,
+				stat_notify_sent,
+				stat_notify_failed,
+				stat_notify_expired);
 }
 
 irom void stats_i2c(string_t *dst)
 {
+	static uint32_t previous_time;
+	static uint64_t previous_busy_cycles;
+	static int previous_transactions, previous_mcp_transactions;
 	i2c_info_t i2c_info;
+	unsigned int cycles_per_us, queued, busy, transaction_rate, mcp_transaction_rate;
+	int transactions, mcp_transactions;
+	uint32_t now;
+	uint64_t elapsed_cycles, busy_cycles, wait_cycles;
 
 	i2c_get_info(&i2c_info);
+	cycles_per_us = system_get_cpu_freq();
+	queued = stat_i2c_queued ? stat_i2c_queued : 1;
+	now = system_get_time();
+	busy_cycles = io_gpio_timer_read64(&stat_i2c_busy_cycles);
+	wait_cycles = io_gpio_timer_read64(&stat_i2c_wait_cycles);
+
+	// bus time since the previous query, in 0.01 ms per second
+
+	elapsed_cycles = (uint64_t)(now - previous_time) * cycles_per_us;
+	busy = elapsed_cycles ? ((busy_cycles - previous_busy_cycles) * 100000) / elapsed_cycles : 0;
+
+	// transactions since the previous query, in 0.01 per second
+
+	transactions = stat_i2c_transactions;
+	mcp_transactions = stat_mcp_i2c_transactions;
+	transaction_rate = (now != previous_time) ? ((uint64_t)(transactions - previous_transactions) * 100000000) / (now - previous_time) : 0;
+	mcp_transaction_rate = (now != previous_time) ? ((uint64_t)(mcp_transactions - previous_mcp_transactions) * 100000000) / (now - previous_time) : 0;
+
+	previous_time = now;
+	previous_busy_cycles = busy_cycles;
+	previous_transactions = transactions;
+	previous_mcp_transactions = mcp_transactions;
 
 	string_format(dst,
-			"> i2c clock delay: %u\n"
+			"> i2c speed requested: %u kHz, used: %u kHz%s, measured: %u.%02u kHz\n"
+			"> i2c half period: %u timer ticks, stop delay: %u\n"
+			"> i2c bus time since last query: %u.%02u ms/s\n"
 			"> display initialisation time: %u us\n"
 			"> i2c initialisation time: %u us\n"
 			"> i2c multiplexer found: %s\n"
-			"> i2c buses: %u\n",
-				i2c_info.delay,
+			"> i2c buses: %u\n"
+			"> i2c transactions: %u, since last query: %u.%02u/s\n"
+			"> i2c transactions by mcp23017: %u, since last query: %u.%02u/s\n"
+			"> i2c queued: %u, merged reads: %u, wait timeouts: %u\n"
+			"> i2c queue depth average: %u.%02u, max: %u\n"
+			"> i2c queue wait average: %u us, max: %u us\n"
+			"> i2c multiplexer selects requested: %u, written: %u, avoided: %d\n",
+				i2c_info.requested_speed, i2c_info.speed, i2c_info.limited ? " (limited by the timer interrupt rate)" : "",
+				i2c_info.measured_speed / 1000, (i2c_info.measured_speed % 1000) / 10,
+				i2c_info.half_period, i2c_info.delay,
+				busy / 100, busy % 100,
 				stat_display_init_time_us,
 				stat_i2c_init_time_us,
 				yesno(i2c_info.multiplexer),
-				i2c_info.buses);
+				i2c_info.buses,
+				transactions, transaction_rate / 100, transaction_rate % 100,
+				mcp_transactions, mcp_transaction_rate / 100, mcp_transaction_rate % 100,
+				stat_i2c_queued, stat_i2c_merged, stat_i2c_wait_timeouts,
+				stat_i2c_queue_depth_total / queued, ((stat_i2c_queue_depth_total * 100) / queued) % 100, stat_i2c_queue_depth_max,
+				(uint32_t)(wait_cycles / (queued * cycles_per_us)), stat_i2c_wait_max_cycles / cycles_per_us,
+				stat_i2c_select_requests, stat_i2c_select_writes, stat_i2c_select_requests - stat_i2c_select_writes);
+}
+
+irom static void stats_pwm_histogram(string_t *dst, const char *name, const int *histogram, unsigned int cycles_per_us)
+{
+	unsigned int bucket, bound_ns;
+
+	for(bucket = 0; bucket < stat_pwm_histogram_size; bucket++)
+	{
+		if(bucket < (stat_pwm_histogram_size - 1))
+		{
+			bound_ns = ((1 << (bucket + stat_pwm_histogram_shift)) * 1000) / cycles_per_us;
+			string_format(dst, "> %s  < %5u ns: %u\n", name, bound_ns, histogram[bucket]);
+		}
+		else
+		{
+			bound_ns = ((1 << (bucket + stat_pwm_histogram_shift - 1)) * 1000) / cycles_per_us;
+			string_format(dst, "> %s >= %5u ns: %u\n", name, bound_ns, histogram[bucket]);
+		}
+	}
+}
+
+irom void stats_pwm(string_t *dst)
+{
+	static uint32_t previous_time;
+	static uint64_t previous_isr_cycles;
+	unsigned int cycles_per_us, share;
+	uint32_t now;
+	uint64_t elapsed_cycles, isr_cycles, busy_wait_cycles;
+
+	cycles_per_us = system_get_cpu_freq();
+	now = system_get_time();
+	isr_cycles = io_gpio_timer_read64(&stat_pwm_isr_cycles);
+	busy_wait_cycles = io_gpio_timer_read64(&stat_pwm_busy_wait_cycles);
+
+	// cpu share of the pwm interrupt since the previous query, in 0.01%
+
+	elapsed_cycles = (uint64_t)(now - previous_time) * cycles_per_us;
+	share = elapsed_cycles ? ((isr_cycles - previous_isr_cycles) * 10000) / elapsed_cycles : 0;
+
+	previous_time = now;
+	previous_isr_cycles = isr_cycles;
+
+	string_format(dst,
+			"> pwm timer int fired: %u\n"
+			"> ... while masked: %u\n"
+			"> pwm isr cpu share since last query: %u.%02u %%\n"
+			"> pwm isr time total: %u ms\n"
+			"> pwm busy wait time total: %u ms\n",
+				stat_pwm_timer_interrupts,
+				stat_pwm_timer_interrupts_while_nmi_masked,
+				share / 100, share % 100,
+				(uint32_t)(isr_cycles / (cycles_per_us * 1000)),
+				(uint32_t)(busy_wait_cycles / (cycles_per_us * 1000)));
+
+	stats_pwm_histogram(dst, "isr time", stat_pwm_isr_histogram, cycles_per_us);
+	stats_pwm_histogram(dst, "edge jitter", stat_pwm_jitter_histogram, cycles_per_us);
 }
 
 irom void stats_wlan(string_t *dst)
@@ -11,6 +11,12 @@ enum
 	stack_bottom = 0x40000000 - sizeof(void *)
 };
 
+enum
+{
+	stat_pwm_histogram_size = 8,
+	stat_pwm_histogram_shift = 6,	// first bucket: < 64 cpu cycles
+};
+
 typedef struct
 {
 	unsigned int user_rf_cal_sector_set:1;
@@ -21,17 +27,52 @@ extern stat_called_t stat_called;
 
 extern int stat_uart_rx_interrupts;
 extern int stat_uart_tx_interrupts;
+extern int stat_gpio_interrupts;
 extern int stat_fast_timer;
 extern int stat_slow_timer;
 extern int stat_pwm_timer_interrupts;
 extern int stat_pwm_timer_interrupts_while_nmi_masked;
+extern int stat_pwm_isr_histogram[stat_pwm_histogram_size];
+extern int stat_pwm_jitter_histogram[stat_pwm_histogram_size];
+extern uint64_t stat_pwm_isr_cycles;
+extern uint64_t stat_pwm_busy_wait_cycles;
 extern int stat_pc_counts;
+extern int stat_mcp_i2c_saved;
+extern int stat_mcp_i2c_transactions;
+extern int stat_io_periodic_us;
+extern int stat_io_periodic_max_us;
+extern int stat_io_journal_overflow;
 extern int stat_i2c_init_time_us;
+extern int stat_i2c_transactions;
+extern int stat_i2c_queued;
+extern int stat_i2c_merged;
+extern int stat_i2c_wait_timeouts;
+extern unsigned int stat_i2c_queue_depth_total;
+extern unsigned int stat_i2c_queue_depth_max;
+extern uint64_t stat_i2c_wait_cycles;
+extern uint32_t stat_i2c_wait_max_cycles;
+extern int stat_i2c_select_requests;
+extern int stat_i2c_select_writes;
+extern uint64_t stat_i2c_busy_cycles;
+extern uint64_t stat_i2c_clock_cycles;
+extern unsigned int stat_i2c_clock_periods;
 extern int stat_display_init_time_us;
 extern int stat_cmd_receive_buffer_overflow;
 extern int stat_cmd_send_buffer_overflow;
 extern int stat_uart_receive_buffer_overflow;
 extern int stat_uart_send_buffer_overflow;
+extern int stat_uart_frames;
+extern int stat_uart_frames_oversize;
+extern int stat_uart_frame_errors;
+extern int stat_modbus_requests;
+extern int stat_modbus_responses;
+extern int stat_modbus_timeouts;
+extern int stat_modbus_crc_errors;
+extern int stat_modbus_invalid;
+extern int stat_modbus_overflow;
+extern int stat_notify_sent;
+extern int stat_notify_failed;
+extern int stat_notify_expired;
 
 extern int stat_update_uart;
 extern int stat_update_longop;
@@ -48,5 +89,6 @@ void stats_firmware(string_t *dst);
 void stats_time(string_t *dst);
 void stats_counters(string_t *dst);
 void stats_i2c(string_t *dst);
+void stats_pwm(string_t *dst);
 void stats_wlan(string_t *dst);
 #endif
@@ -0,0 +1,24 @@
+#ifndef _C_TYPES_H_
+#define _C_TYPES_H_
+
+// host stand-in for the sdk header, only what the tested modules use
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef uint8_t		uint8;
+typedef int8_t		sint8;
+typedef int8_t		int8;
+typedef uint16_t	uint16;
+typedef int16_t		sint16;
+typedef int16_t		int16;
+typedef uint32_t	uint32;
+typedef int32_t		sint32;
+typedef int32_t		int32;
+
+typedef enum { OK = 0, FAIL, PENDING, BUSY, CANCEL } STATUS;
+
+#define ICACHE_FLASH_ATTR
+
+#endif
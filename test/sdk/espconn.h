@@ -0,0 +1,15 @@
+#ifndef __ESPCONN_H__
+#define __ESPCONN_H__
+
+// host stand-in for the sdk header, only what the tested modules use
+
+#include "c_types.h"
+
+typedef struct { int remote_port; int local_port; uint8 local_ip[4]; uint8 remote_ip[4]; } esp_udp;
+typedef struct { int remote_port; int local_port; uint8 local_ip[4]; uint8 remote_ip[4]; } esp_tcp;
+
+struct espconn { int type; int state; void *reverse; };
+
+sint8 espconn_disconnect(struct espconn *espconn);
+
+#endif
@@ -0,0 +1,8 @@
+#ifndef _ETS_SYS_H
+#define _ETS_SYS_H
+
+// host stand-in for the sdk header, only what the tested modules use
+
+#include "c_types.h"
+
+#endif
@@ -0,0 +1,10 @@
+#ifndef __IP_ADDR_H__
+#define __IP_ADDR_H__
+
+#include "c_types.h"
+
+typedef struct ip_addr { uint32_t addr; } ip_addr_t;
+
+struct ip_info { struct ip_addr ip; struct ip_addr netmask; struct ip_addr gw; };
+
+#endif
@@ -0,0 +1,6 @@
+#ifndef __MEM_H__
+#define __MEM_H__
+
+#include <stddef.h>
+
+#endif
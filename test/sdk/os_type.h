@@ -0,0 +1,10 @@
+#ifndef _OS_TYPE_H_
+#define _OS_TYPE_H_
+
+// host stand-in for the sdk header, only what the tested modules use
+
+#include "c_types.h"
+
+typedef struct { uint32_t sig; uint32_t par; } os_event_t;
+
+#endif
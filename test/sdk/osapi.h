@@ -0,0 +1,8 @@
+#ifndef _OSAPI_H_
+#define _OSAPI_H_
+
+// util.h redefines strcpy and friends, so string.h must come in first
+
+#include <string.h>
+
+#endif
@@ -0,0 +1,14 @@
+#ifndef __USER_INTERFACE_H__
+#define __USER_INTERFACE_H__
+
+// host stand-in for the sdk header, only what the tested modules use
+
+#include "c_types.h"
+#include "os_type.h"
+#include "ip_addr.h"
+
+enum { USER_TASK_PRIO_0 = 0 };
+
+uint32 system_get_time(void);
+
+#endif
@@ -0,0 +1,43 @@
+#include "test.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <time.h>
+
+static unsigned int checks, failures;
+
+void test_check(int ok, const char *expression, const char *file, int line)
+{
+	checks++;
+
+	if(!ok)
+	{
+		failures++;
+		fprintf(stderr, "%s:%d: check failed: %s\n", file, line, expression);
+	}
+}
+
+void test_report(const char *format, ...)
+{
+	va_list ap;
+
+	va_start(ap, format);
+	vprintf(format, ap);
+	va_end(ap);
+}
+
+uint64_t test_time_ns(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return(((uint64_t)now.tv_sec * 1000000000) + (uint64_t)now.tv_nsec);
+}
+
+int test_done(const char *name)
+{
+	printf("%s: %u checks, %u failed\n", name, checks, failures);
+
+	return(failures ? 1 : 0);
+}
@@ -0,0 +1,17 @@
+#ifndef test_h
+#define test_h
+
+#include <stdint.h>
+
+// host test harness, kept apart from the firmware headers, util.h has its
+// own versions of some libc functions (log, dprintf) and struct tm, so the
+// tests don't include stdio.h or time.h themselves
+
+void		test_check(int ok, const char *expression, const char *file, int line);
+void		test_report(const char *format, ...) __attribute__ ((format (printf, 1, 2)));
+uint64_t	test_time_ns(void);
+int			test_done(const char *name);
+
+#define check(expression) test_check(!!(expression), #expression, __FILE__, __LINE__)
+
+#endif
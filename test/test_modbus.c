@@ -0,0 +1,514 @@
+#include "test.h"
+
+// modbus.c is included, so the static crc and state can be checked
+
+#include "../modbus.c"
+
+// stand-ins for the firmware and the sdk, the uart is replaced by a
+// simulated rtu slave, the clock is set by the tests
+
+int stat_uart_receive_buffer_overflow;
+int stat_modbus_requests;
+int stat_modbus_responses;
+int stat_modbus_timeouts;
+int stat_modbus_crc_errors;
+int stat_modbus_invalid;
+int stat_modbus_overflow;
+
+static char uart_send_buffer[1024];
+static char uart_receive_buffer[1024];
+
+queue_t uart_send_queue = { uart_send_buffer, sizeof(uart_send_buffer), 0, 0, 0 };
+queue_t uart_receive_queue = { uart_receive_buffer, sizeof(uart_receive_buffer), 0, 0, 0 };
+
+static uint32_t now_us;
+static unsigned int rx_flushes;
+
+uint32 system_get_time(void)
+{
+	return(now_us);
+}
+
+void uart_rx_flush(void)
+{
+	rx_flushes++;
+}
+
+// the rtu slave, unit 5, 16 holding registers, answers read holding
+// registers (3) and write single register (6), anything else with an
+// illegal function exception, it stays silent when it's switched off,
+// for a broadcast or a frame with a bad crc
+
+enum
+{
+	slave_unit = 5,
+	slave_registers = 16,
+	frame_size = 260,
+};
+
+static struct
+{
+	bool_t		online;
+	unsigned int	frames;
+	unsigned int	frame_length;
+	uint8_t		frame[frame_size];		// last frame on the line
+	unsigned int	reply_length;
+	uint8_t		reply[frame_size];		// its reply, 0 length if none
+	uint16_t	reg[slave_registers];
+} slave;
+
+static void slave_reply_crc(void)
+{
+	uint16_t crc;
+
+	crc = modbus_crc16(0xffff, slave.reply_length, slave.reply);
+	slave.reply[slave.reply_length++] = (crc >> 0) & 0xff;
+	slave.reply[slave.reply_length++] = (crc >> 8) & 0xff;
+}
+
+static void slave_exception(uint8_t function, uint8_t code)
+{
+	slave.reply[0] = slave_unit;
+	slave.reply[1] = function | 0x80;
+	slave.reply[2] = code;
+	slave.reply_length = 3;
+	slave_reply_crc();
+}
+
+void uart_start_transmit(char enable)
+{
+	const uint8_t *frame;
+	unsigned int address, count, ix;
+	uint16_t crc;
+
+	check(enable);
+
+	for(slave.frame_length = 0; !queue_empty(&uart_send_queue); slave.frame_length++)
+		slave.frame[slave.frame_length] = (uint8_t)queue_pop(&uart_send_queue);
+
+	slave.frames++;
+	slave.reply_length = 0;
+	frame = slave.frame;
+
+	if(!slave.online || (slave.frame_length < 4))
+		return;
+
+	crc = modbus_crc16(0xffff, slave.frame_length - 2, frame);
+
+	if((frame[slave.frame_length - 2] != ((crc >> 0) & 0xff)) || (frame[slave.frame_length - 1] != ((crc >> 8) & 0xff)))
+		return;
+
+	if(frame[0] != slave_unit)
+		return;
+
+	address = (frame[2] << 8) | frame[3];
+	count = (frame[4] << 8) | frame[5];
+
+	switch(frame[1])
+	{
+		case(0x03):
+		{
+			if(((address + count) > slave_registers) || (count == 0))
+			{
+				slave_exception(frame[1], 0x02);
+				return;
+			}
+
+			slave.reply[0] = slave_unit;
+			slave.reply[1] = 0x03;
+			slave.reply[2] = count * 2;
+			slave.reply_length = 3;
+
+			for(ix = 0; ix < count; ix++)
+			{
+				slave.reply[slave.reply_length++] = (slave.reg[address + ix] >> 8) & 0xff;
+				slave.reply[slave.reply_length++] = (slave.reg[address + ix] >> 0) & 0xff;
+			}
+
+			slave_reply_crc();
+
+			break;
+		}
+
+		case(0x06):
+		{
+			if(address >= slave_registers)
+			{
+				slave_exception(frame[1], 0x02);
+				return;
+			}
+
+			slave.reg[address] = count;
+			memcpy(slave.reply, frame, 6);
+			slave.reply_length = 6;
+			slave_reply_crc();
+
+			break;
+		}
+
+		default:
+		{
+			slave_exception(frame[1], 0x01);
+
+			break;
+		}
+	}
+}
+
+// a tcp client, sends requests with an mbap header
+
+static socket_t client;
+
+static void client_request(uint16_t transaction, uint8_t unit, unsigned int length, const uint8_t *pdu)
+{
+	string_new(static, request, 512);
+
+	string_clear(&request);
+	string_append_char(&request, (transaction >> 8) & 0xff);
+	string_append_char(&request, (transaction >> 0) & 0xff);
+	string_append_char(&request, 0x00);
+	string_append_char(&request, 0x00);
+	string_append_char(&request, ((length + 1) >> 8) & 0xff);
+	string_append_char(&request, ((length + 1) >> 0) & 0xff);
+	string_append_char(&request, unit);
+
+	for(; length > 0; length--)
+		string_append_char(&request, *pdu++);
+
+	modbus_request(&client, &request);
+}
+
+// the gateway found the end of the slave's reply, hand it to modbus_response
+
+static bool_t gateway_receive(string_t *frame, socket_t *socket, const uint8_t *reply, unsigned int length)
+{
+	string_clear(frame);
+
+	for(; length > 0; length--)
+		string_append_char(frame, *reply++);
+
+	return(modbus_response(frame, socket));
+}
+
+// back to an idle gateway, an online slave and a fresh client
+
+static void gateway_reset(void)
+{
+	modbus_queue_in = 0;
+	modbus_queue_out = 0;
+	modbus_active = false;
+
+	memset(&slave, 0, sizeof(slave));
+	slave.online = true;
+
+	client.remote.proto = proto_tcp;
+	client.remote.port = 40000;
+
+	now_us = 0;
+	rx_flushes = 0;
+
+	stat_modbus_requests = 0;
+	stat_modbus_responses = 0;
+	stat_modbus_timeouts = 0;
+	stat_modbus_crc_errors = 0;
+	stat_modbus_invalid = 0;
+	stat_modbus_overflow = 0;
+}
+
+static void test_crc(void)
+{
+	static const uint8_t frame[] = { 0x01, 0x03, 0x00, 0x00, 0x00, 0x0a };
+	static const uint8_t frame_crc[] = { 0x01, 0x03, 0x00, 0x00, 0x00, 0x0a, 0xc5, 0xcd };
+
+	// the example frame from the modbus over serial line spec
+
+	check(modbus_crc16(0xffff, sizeof(frame), frame) == 0xcdc5);
+
+	// a frame followed by its crc checks out to 0
+
+	check(modbus_crc16(0xffff, sizeof(frame_crc), frame_crc) == 0x0000);
+
+	// it can be run in pieces
+
+	check(modbus_crc16(modbus_crc16(0xffff, 1, frame), sizeof(frame) - 1, frame + 1) == 0xcdc5);
+}
+
+static void test_read(void)
+{
+	static const uint8_t pdu[] = { 0x03, 0x00, 0x02, 0x00, 0x03 };
+	static const uint8_t rtu[] = { slave_unit, 0x03, 0x00, 0x02, 0x00, 0x03 };
+	static const uint8_t mbap[] = { 0x12, 0x34, 0x00, 0x00, 0x00, 0x09, slave_unit, 0x03, 0x06, 0x11, 0x11, 0x22, 0x22, 0x33, 0x33 };
+	string_new(, frame, 512);
+	socket_t socket;
+
+	gateway_reset();
+	slave.reg[2] = 0x1111;
+	slave.reg[3] = 0x2222;
+	slave.reg[4] = 0x3333;
+
+	client_request(0x1234, slave_unit, sizeof(pdu), pdu);
+	check(stat_modbus_requests == 1);
+
+	// mbap header out, unit id in, crc appended
+
+	modbus_transmit();
+	check(slave.frames == 1);
+	check(rx_flushes == 1);
+	check(slave.frame_length == (sizeof(rtu) + 2));
+	check(!memcmp(slave.frame, rtu, sizeof(rtu)));
+	check(modbus_crc16(0xffff, slave.frame_length, slave.frame) == 0x0000);
+
+	// only one request on the line at a time
+
+	modbus_transmit();
+	check(slave.frames == 1);
+
+	// unit id and crc out, mbap header with the client's transaction id in
+
+	memset(&socket, 0, sizeof(socket));
+	check(gateway_receive(&frame, &socket, slave.reply, slave.reply_length));
+	check(string_length(&frame) == sizeof(mbap));
+	check(!memcmp(string_buffer(&frame), mbap, sizeof(mbap)));
+	check(socket.remote.proto == proto_tcp);
+	check(socket.remote.port == 40000);
+	check(stat_modbus_responses == 1);
+	check(!modbus_active);
+}
+
+static void test_segment(void)
+{
+	static const uint8_t segment_data[] =
+	{
+		0x00, 0x01, 0x00, 0x00, 0x00, 0x06, slave_unit, 0x06, 0x00, 0x07, 0xab, 0xcd,
+		0x00, 0x02, 0x00, 0x00, 0x00, 0x06, slave_unit, 0x03, 0x00, 0x07, 0x00, 0x01,
+	};
+	static const uint8_t mbap_read[] = { 0x00, 0x02, 0x00, 0x00, 0x00, 0x05, slave_unit, 0x03, 0x02, 0xab, 0xcd };
+	string_new(, segment, 512);
+	string_new(, frame, 512);
+	socket_t socket;
+	unsigned int ix;
+
+	gateway_reset();
+
+	// two requests in one tcp segment, both are queued, run in order
+
+	string_clear(&segment);
+
+	for(ix = 0; ix < sizeof(segment_data); ix++)
+		string_append_char(&segment, segment_data[ix]);
+
+	modbus_request(&client, &segment);
+	check(stat_modbus_requests == 2);
+
+	modbus_transmit();
+	check(slave.frame[1] == 0x06);
+	check(gateway_receive(&frame, &socket, slave.reply, slave.reply_length));
+	check((string_at(&frame, 0) == 0x00) && (string_at(&frame, 1) == 0x01));
+
+	modbus_transmit();
+	check(slave.frame[1] == 0x03);
+	check(gateway_receive(&frame, &socket, slave.reply, slave.reply_length));
+	check(string_length(&frame) == sizeof(mbap_read));
+	check(!memcmp(string_buffer(&frame), mbap_read, sizeof(mbap_read)));
+	check(stat_modbus_responses == 2);
+}
+
+static void test_invalid(void)
+{
+	static const uint8_t pdu[] = { 0x03, 0x00, 0x00, 0x00, 0x01 };
+	static const uint8_t bad_protocol[] = { 0x00, 0x01, 0x00, 0x01, 0x00, 0x06, slave_unit, 0x03, 0x00, 0x00, 0x00, 0x01 };
+	static const uint8_t short_segment[] = { 0x00, 0x01, 0x00, 0x00, 0x00, 0x06, slave_unit, 0x03, 0x00 };
+	string_new(, segment, 512);
+	string_new(, frame, 512);
+	socket_t socket;
+	unsigned int ix;
+
+	gateway_reset();
+
+	// not modbus tcp, or cut short
+
+	string_clear(&segment);
+	for(ix = 0; ix < sizeof(bad_protocol); ix++)
+		string_append_char(&segment, bad_protocol[ix]);
+	modbus_request(&client, &segment);
+
+	string_clear(&segment);
+	for(ix = 0; ix < sizeof(short_segment); ix++)
+		string_append_char(&segment, short_segment[ix]);
+	modbus_request(&client, &segment);
+
+	check(stat_modbus_invalid == 2);
+	check(stat_modbus_requests == 0);
+
+	// a reply while nothing is on the line
+
+	check(!gateway_receive(&frame, &socket, (const uint8_t *)"\x05\x03\x00\x00", 4));
+	check(stat_modbus_invalid == 3);
+
+	// the queue holds three requests
+
+	for(ix = 0; ix < 4; ix++)
+		client_request(ix, slave_unit, sizeof(pdu), pdu);
+
+	check(stat_modbus_requests == 3);
+	check(stat_modbus_overflow == 1);
+
+	// a bad crc or a reply from another unit is dropped, the request
+	// stays active
+
+	modbus_transmit();
+	slave.reply[3] ^= 0x01;
+	check(!gateway_receive(&frame, &socket, slave.reply, slave.reply_length));
+	check(stat_modbus_crc_errors == 1);
+	check(modbus_active);
+
+	slave.reply[3] ^= 0x01;
+	slave.reply[0] = slave_unit + 1;
+	slave.reply_length -= 2;
+	slave_reply_crc();
+	check(!gateway_receive(&frame, &socket, slave.reply, slave.reply_length));
+	check(stat_modbus_invalid == 4);
+	check(modbus_active);
+
+	// the slave's exception is passed on
+
+	slave.reply[0] = slave_unit;
+	slave.reply[1] = 0x83;
+	slave.reply[2] = 0x02;
+	slave.reply_length = 3;
+	slave_reply_crc();
+	check(gateway_receive(&frame, &socket, slave.reply, slave.reply_length));
+	check(string_length(&frame) == (modbus_mbap_size + 3));
+	check(modbus_byte_at(&frame, 7) == 0x83);
+	check(modbus_byte_at(&frame, 8) == 0x02);
+}
+
+static void test_timeout(void)
+{
+	static const uint8_t pdu_read[] = { 0x03, 0x00, 0x00, 0x00, 0x01 };
+	static const uint8_t pdu_write[] = { 0x06, 0x00, 0x01, 0x00, 0x2a };
+	static const uint8_t exception[] = { 0x00, 0x07, 0x00, 0x00, 0x00, 0x03, slave_unit, 0x83, 0x0b };
+	string_new(, frame, 512);
+	socket_t socket;
+	uint8_t late[frame_size];
+	unsigned int late_length;
+
+	gateway_reset();
+	slave.online = false;
+	now_us = 0xfff00000;	// close to the wrap around of the clock
+
+	client_request(0x0007, slave_unit, sizeof(pdu_read), pdu_read);
+	modbus_transmit();
+
+	// no reply within the timeout, the client gets a "target device
+	// failed to respond" exception
+
+	now_us += modbus_response_timeout_us - 1;
+	check(!modbus_timeout(&frame, &socket));
+	check(modbus_active);
+
+	now_us += 1;
+	check(modbus_timeout(&frame, &socket));
+	check(string_length(&frame) == sizeof(exception));
+	check(!memcmp(string_buffer(&frame), exception, sizeof(exception)));
+	check(socket.remote.proto == proto_tcp);
+	check(stat_modbus_timeouts == 1);
+	check(!modbus_active);
+
+	// once done, it doesn't time out again
+
+	now_us += modbus_response_timeout_us;
+	check(!modbus_timeout(&frame, &socket));
+	check(stat_modbus_timeouts == 1);
+
+	// the slave comes back, its late reply to the read arrives while the
+	// write is active, the receive buffer is flushed before the write
+	// goes out and the reply doesn't match the write, so it's dropped
+
+	slave.online = true;
+	slave.reply[0] = slave_unit;
+	slave.reply[1] = 0x03;
+	slave.reply[2] = 0x02;
+	slave.reply[3] = 0x00;
+	slave.reply[4] = 0x00;
+	slave.reply_length = 5;
+	slave_reply_crc();
+	memcpy(late, slave.reply, slave.reply_length);
+	late_length = slave.reply_length;
+
+	client_request(0x0008, slave_unit, sizeof(pdu_write), pdu_write);
+	modbus_transmit();
+	check(rx_flushes == 2);
+
+	check(!gateway_receive(&frame, &socket, late, late_length));
+	check(stat_modbus_invalid == 1);
+	check(modbus_active);
+
+	check(gateway_receive(&frame, &socket, slave.reply, slave.reply_length));
+	check((string_at(&frame, 0) == 0x00) && (string_at(&frame, 1) == 0x08));
+	check(slave.reg[1] == 0x2a);
+	check(stat_modbus_responses == 1);
+}
+
+static void test_broadcast(void)
+{
+	static const uint8_t pdu[] = { 0x06, 0x00, 0x01, 0x00, 0x01 };
+	string_new(, frame, 512);
+	socket_t socket;
+
+	gateway_reset();
+
+	// a broadcast gets no reply, it's done after the turnaround delay,
+	// without an answer to the client
+
+	client_request(0x0009, 0, sizeof(pdu), pdu);
+	client_request(0x000a, slave_unit, sizeof(pdu), pdu);
+	modbus_transmit();
+	check(slave.frame[0] == 0);
+	check(slave.reply_length == 0);
+
+	now_us += modbus_broadcast_delay_us - 1;
+	check(!modbus_timeout(&frame, &socket));
+	modbus_transmit();
+	check(slave.frames == 1);
+
+	now_us += 1;
+	check(!modbus_timeout(&frame, &socket));
+	check(stat_modbus_timeouts == 0);
+	modbus_transmit();
+	check(slave.frames == 2);
+	check(slave.frame[0] == slave_unit);
+}
+
+static void test_disconnect(void)
+{
+	static const uint8_t pdu[] = { 0x03, 0x00, 0x00, 0x00, 0x01 };
+	string_new(, frame, 512);
+	socket_t socket;
+
+	gateway_reset();
+
+	// the tcp client is gone, the transaction still runs, but the reply
+	// is dropped
+
+	client_request(0x000b, slave_unit, sizeof(pdu), pdu);
+	modbus_transmit();
+	modbus_disconnect();
+
+	check(!gateway_receive(&frame, &socket, slave.reply, slave.reply_length));
+	check(stat_modbus_responses == 1);
+	check(!modbus_active);
+}
+
+int main(void)
+{
+	test_crc();
+	test_read();
+	test_segment();
+	test_invalid();
+	test_timeout();
+	test_broadcast();
+	test_disconnect();
+
+	return(test_done("modbus"));
+}
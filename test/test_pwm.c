@@ -0,0 +1,316 @@
+#include "test.h"
+
+#include "../pwm.h"
+
+// runs the phase table like pwm_isr_phases does, for every frame of the
+// dither cycle, and returns the number of timer ticks each pin is on,
+// summed over all frames, the highest number of pins that are on
+// at the same time goes into max_on
+
+static void simulate(const pwm_phases_t *phase_data, unsigned int on_ticks[pwm_max_channels], unsigned int *max_on)
+{
+	unsigned int frame, phase, delay, pin, pins_on;
+	uint32_t state;
+
+	for(pin = 0; pin < pwm_max_channels; pin++)
+		on_ticks[pin] = 0;
+
+	*max_on = 0;
+
+	for(frame = 0; frame < pwm_dither_frames; frame++)
+	{
+		state = phase_data->init_set_mask & ~phase_data->init_clear_mask;
+
+		for(phase = 0; phase < phase_data->size; phase++)
+		{
+			state |= phase_data->phase[phase].set_mask;
+			state &= ~phase_data->phase[phase].clear_mask;
+
+			delay = phase_data->phase[phase].delay;
+
+			if(phase_data->phase[phase].dither & (1 << frame))
+				delay--;
+
+			if(((phase + 1) < phase_data->size) && (phase_data->phase[phase + 1].dither & (1 << frame)))
+				delay++;
+
+			for(pin = 0, pins_on = 0; pin < pwm_max_channels; pin++)
+			{
+				if(state & (1 << pin))
+				{
+					on_ticks[pin] += delay;
+					pins_on++;
+				}
+			}
+
+			if(pins_on > *max_on)
+				*max_on = pins_on;
+		}
+	}
+}
+
+static void setup_init(pwm_setup_t *setup, unsigned int period, unsigned int min_gap, unsigned int dither_bits, bool_t stagger)
+{
+	setup->period = period;
+	setup->min_gap = pwm_min_gap_limit(period, min_gap);
+	setup->dither_bits = dither_bits;
+	setup->stagger = stagger;
+}
+
+static void test_single(void)
+{
+	pwm_phases_t phases;
+	pwm_channels_t channels = { .size = 0 };
+	pwm_setup_t setup;
+	unsigned int duty[pwm_max_channels] = { 0 };
+	unsigned int on_ticks[pwm_max_channels], max_on;
+
+	setup_init(&setup, 65536, pwm_min_gap_default, 0, false);
+	duty[4] = 1000;
+
+	pwm_phases_build(&phases, &channels, &setup, 1 << 4, duty);
+
+	check(phases.size == 2);
+	check(phases.phase[0].set_mask == (1 << 4));
+	check(phases.phase[0].delay == 1000);
+	check(phases.phase[1].clear_mask == (1 << 4));
+	check(phases.phase[1].delay == (65535 - 1000));
+	check(!phases.dither);
+
+	simulate(&phases, on_ticks, &max_on);
+	check(on_ticks[4] == (1000 * pwm_dither_frames));
+}
+
+static void test_sorted(void)
+{
+	pwm_phases_t phases;
+	pwm_channels_t channels = { .size = 0 };
+	pwm_setup_t setup;
+	unsigned int duty[pwm_max_channels] = { 0 };
+	unsigned int on_ticks[pwm_max_channels], max_on, phase;
+
+	setup_init(&setup, 65536, pwm_min_gap_default, 0, false);
+	duty[0] = 30000;
+	duty[2] = 100;
+	duty[5] = 5000;
+
+	pwm_phases_build(&phases, &channels, &setup, (1 << 0) | (1 << 2) | (1 << 5), duty);
+
+	check(channels.size == 3);
+	check((channels.pin[0] == 2) && (channels.pin[1] == 5) && (channels.pin[2] == 0));
+	check(phases.size == 4);
+
+	for(phase = 1; phase < phases.size; phase++)
+		check(phases.phase[phase].duty > phases.phase[phase - 1].duty);
+
+	simulate(&phases, on_ticks, &max_on);
+	check(on_ticks[0] == (30000 * pwm_dither_frames));
+	check(on_ticks[2] == (100 * pwm_dither_frames));
+	check(on_ticks[5] == (5000 * pwm_dither_frames));
+
+	// a changed duty moves the channel, the others keep their order
+
+	duty[2] = 40000;
+
+	pwm_phases_build(&phases, &channels, &setup, (1 << 0) | (1 << 2) | (1 << 5), duty);
+
+	check((channels.pin[0] == 5) && (channels.pin[1] == 0) && (channels.pin[2] == 2));
+
+	simulate(&phases, on_ticks, &max_on);
+	check(on_ticks[2] == (40000 * pwm_dither_frames));
+}
+
+static void test_full_scale(void)
+{
+	pwm_phases_t phases;
+	pwm_channels_t channels = { .size = 0 };
+	pwm_setup_t setup;
+	unsigned int duty[pwm_max_channels] = { 0 };
+
+	setup_init(&setup, 1024, pwm_min_gap_default, 0, false);
+	duty[1] = 0;
+	duty[3] = 1023;
+
+	pwm_phases_build(&phases, &channels, &setup, (1 << 1) | (1 << 3), duty);
+
+	check(phases.size == 0);
+	check(phases.init_clear_mask == (1 << 1));
+	check(phases.init_set_mask == (1 << 3));
+	check(channels.size == 0);
+}
+
+static void test_min_gap(void)
+{
+	pwm_phases_t phases;
+	pwm_channels_t channels = { .size = 0 };
+	pwm_setup_t setup;
+	unsigned int duty[pwm_max_channels] = { 0 };
+	unsigned int on_ticks[pwm_max_channels], max_on;
+
+	// within min gap, the later channel shares the phase of the earlier one
+
+	setup_init(&setup, 65536, pwm_min_gap_default, 0, false);
+	duty[0] = 1000;
+	duty[1] = 1010;
+
+	pwm_phases_build(&phases, &channels, &setup, (1 << 0) | (1 << 1), duty);
+
+	check(phases.size == 2);
+	check(phases.phase[1].clear_mask == ((1 << 0) | (1 << 1)));
+
+	simulate(&phases, on_ticks, &max_on);
+	check(on_ticks[1] == (1000 * pwm_dither_frames));
+
+	// apart by at least min gap, separate phases
+
+	duty[1] = 1000 + pwm_min_gap_default;
+
+	pwm_phases_build(&phases, &channels, &setup, (1 << 0) | (1 << 1), duty);
+
+	check(phases.size == 3);
+
+	simulate(&phases, on_ticks, &max_on);
+	check(on_ticks[1] == ((1000 + pwm_min_gap_default) * pwm_dither_frames));
+
+	// at a short period the gap is limited to period / 64, so these
+	// channels are not merged anymore
+
+	setup_init(&setup, 256, pwm_min_gap_default, 0, false);
+	check(setup.min_gap == (256 / pwm_min_gap_period_fraction));
+
+	duty[0] = 100;
+	duty[1] = 110;
+
+	pwm_phases_build(&phases, &channels, &setup, (1 << 0) | (1 << 1), duty);
+
+	check(phases.size == 3);
+
+	simulate(&phases, on_ticks, &max_on);
+	check(on_ticks[0] == (100 * pwm_dither_frames));
+	check(on_ticks[1] == (110 * pwm_dither_frames));
+}
+
+static void test_dither(void)
+{
+	pwm_phases_t phases;
+	pwm_channels_t channels = { .size = 0 };
+	pwm_setup_t setup;
+	unsigned int duty[pwm_max_channels] = { 0 };
+	unsigned int on_ticks[pwm_max_channels], max_on, fraction, bits;
+
+	// the fraction below one tick is spread over the frames, on average
+	// the duty comes out exact
+
+	for(bits = 1; bits <= pwm_dither_bits_max; bits++)
+	{
+		for(fraction = 0; fraction < (1U << bits); fraction++)
+		{
+			setup_init(&setup, 1024, pwm_min_gap_default, bits, false);
+			duty[7] = (300 << bits) + fraction;
+
+			pwm_phases_build(&phases, &channels, &setup, 1 << 7, duty);
+
+			check(phases.size == 2);
+			check(!!phases.dither == (fraction != 0));
+
+			simulate(&phases, on_ticks, &max_on);
+			check(on_ticks[7] == (((300 << bits) + fraction) * (pwm_dither_frames >> bits)));
+		}
+	}
+}
+
+static void test_stagger(void)
+{
+	pwm_phases_t phases;
+	pwm_channels_t channels = { .size = 0 };
+	pwm_setup_t setup;
+	unsigned int duty[pwm_max_channels] = { 0 };
+	unsigned int on_ticks[pwm_max_channels], max_on, pin;
+	uint32_t analog_mask;
+
+	// four channels at 20%, staggered they never overlap
+
+	setup_init(&setup, 1000, pwm_min_gap_default, 0, true);
+
+	for(pin = 0, analog_mask = 0; pin < 4; pin++)
+	{
+		duty[pin] = 200;
+		analog_mask |= 1 << pin;
+	}
+
+	pwm_phases_build(&phases, &channels, &setup, analog_mask, duty);
+
+	check(phases.size > 2);
+
+	simulate(&phases, on_ticks, &max_on);
+	check(max_on == 1);
+
+	for(pin = 0; pin < 4; pin++)
+		check(on_ticks[pin] == (200 * pwm_dither_frames));
+
+	// a channel that runs past the end of the period wraps around to the
+	// start, it's on in phase 0
+
+	duty[3] = 600;
+
+	pwm_phases_build(&phases, &channels, &setup, analog_mask, duty);
+
+	check(phases.phase[0].set_mask & (1 << 3));
+
+	simulate(&phases, on_ticks, &max_on);
+	check(on_ticks[3] == (600 * pwm_dither_frames));
+}
+
+// time the builder with all channels in use, the figures are for the host,
+// on the esp8266 (80 MHz, running from flash) expect a few hundred
+// times slower
+
+static void benchmark(const char *name, bool_t stagger, unsigned int dither_bits)
+{
+	enum { rounds = 100000 };
+	pwm_phases_t phases;
+	pwm_channels_t channels = { .size = 0 };
+	pwm_setup_t setup;
+	unsigned int duty[pwm_max_channels];
+	unsigned int round, pin, seed;
+	uint64_t start, elapsed;
+
+	setup_init(&setup, 65536, pwm_min_gap_default, dither_bits, stagger);
+	seed = 1;
+	elapsed = 0;
+
+	for(round = 0; round < rounds; round++)
+	{
+		// move a few channels, like a fade does
+
+		for(pin = 0; pin < pwm_max_channels; pin++)
+		{
+			seed = (seed * 1103515245) + 12345;
+
+			if((round == 0) || (pin < 3))
+				duty[pin] = (seed >> 8) % (65535 << dither_bits);
+		}
+
+		start = test_time_ns();
+		pwm_phases_build(&phases, &channels, &setup, 0xffff, duty);
+		elapsed += test_time_ns() - start;
+	}
+
+	test_report("pwm_phases_build %-14s %u channels: %u ns per build\n", name, pwm_max_channels, (unsigned int)(elapsed / rounds));
+}
+
+int main(void)
+{
+	test_single();
+	test_sorted();
+	test_full_scale();
+	test_min_gap();
+	test_dither();
+	test_stagger();
+
+	benchmark("sorted", false, 0);
+	benchmark("dither", false, pwm_dither_bits_max);
+	benchmark("staggered", true, 0);
+
+	return(test_done("pwm"));
+}
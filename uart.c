@@ -12,6 +12,18 @@
 
 #include "esp-uart-register.h"
 
+enum
+{
+	uart_rx_tout_default = 2,
+	uart_rx_frames_size = 16,
+};
+
+static int uart_rx_gap = 0;
+static int uart_rx_frame_length = 0;
+static int uart_rx_frames_in = 0;
+static int uart_rx_frames_out = 0;
+static int uart_rx_frames[uart_rx_frames_size];
+
 irom attr_pure uart_parity_t uart_string_to_parity(const string_t *src)
 {
 	uart_parity_t rv;
@@ -50,6 +62,43 @@ irom attr_pure attr_const char uart_parity_to_char(uart_parity_t ix)
 	return(parity[ix]);
 }
 
+irom attr_pure uart_framing_t uart_string_to_framing(const string_t *src)
+{
+	uart_framing_t rv;
+
+	if(string_match_cstr(src, "none"))
+		rv = uart_framing_none;
+	else if(string_match_cstr(src, "slip"))
+		rv = uart_framing_slip;
+	else if(string_match_cstr(src, "cobs"))
+		rv = uart_framing_cobs;
+	else if(string_match_cstr(src, "delimiter"))
+		rv = uart_framing_delimiter;
+	else if(string_match_cstr(src, "gap"))
+		rv = uart_framing_gap;
+	else if(string_match_cstr(src, "modbus"))
+		rv = uart_framing_modbus;
+	else
+		rv = uart_framing_error;
+
+	return(rv);
+}
+
+irom void uart_framing_to_string(string_t *dst, uart_framing_t ix)
+{
+	static const char *framing[] =
+	{
+		"none",
+		"slip",
+		"cobs",
+		"delimiter",
+		"gap",
+		"modbus",
+	};
+
+	string_format(dst, "%s", ix < uart_framing_error ? framing[ix] : "<error>");
+}
+
 irom void uart_parameters_to_string(string_t *dst, const uart_parameters_t *params)
 {
 	string_format(dst, "%u %u%c%u",
@@ -69,35 +118,86 @@ iram static int uart_tx_fifo_length(void)
 	return((read_peri_reg(UART_STATUS(0)) >> UART_TXFIFO_CNT_S) & UART_TXFIFO_CNT);
 }
 
+iram static void uart_rx_frame_end(void)
+{
+	int next;
+
+	if(uart_rx_frame_length == 0)
+		return;
+
+	next = (uart_rx_frames_in + 1) % uart_rx_frames_size;
+
+	// when there is no room for another frame boundary, the frame will
+	// be merged with the next one, no data is lost
+
+	if(next != uart_rx_frames_out)
+	{
+		uart_rx_frames[uart_rx_frames_in] = uart_rx_frame_length;
+		uart_rx_frames_in = next;
+		uart_rx_frame_length = 0;
+	}
+}
+
+iram int uart_rx_frame_pop(void)
+{
+	int length;
+
+	if(uart_rx_frames_in == uart_rx_frames_out)
+		return(-1);
+
+	length = uart_rx_frames[uart_rx_frames_out];
+	uart_rx_frames_out = (uart_rx_frames_out + 1) % uart_rx_frames_size;
+
+	return(length);
+}
+
 iram static void uart_callback(void *p)
 {
 	char data;
+	uint32_t status;
+	int keep;
 
 	ETS_UART_INTR_DISABLE();
 
+	status = read_peri_reg(UART_INT_ST(0));
+
 	// receive fifo "timeout" or "full" -> data available
 
-	if(read_peri_reg(UART_INT_ST(0)) & (UART_RXFIFO_TOUT_INT_ST | UART_RXFIFO_FULL_INT_ST))
+	if(status & (UART_RXFIFO_TOUT_INT_ST | UART_RXFIFO_FULL_INT_ST))
 	{
 		stat_uart_rx_interrupts++;
 
 		// make sure to fetch all data from the fifo, or we'll get a another
 		// interrupt immediately after we enable it
 
-		while(uart_rx_fifo_length() > 0)
+		// in gap framing mode, leave one byte in the fifo on a "full"
+		// interrupt, the "timeout" interrupt only fires when the fifo
+		// is not empty and we need it to detect the end of the frame
+
+		keep = (uart_rx_gap && !(status & UART_RXFIFO_TOUT_INT_ST)) ? 1 : 0;
+
+		while(uart_rx_fifo_length() > keep)
 		{
 			data = read_peri_reg(UART_FIFO(0));
 
 			if(!queue_full(&uart_receive_queue))
+			{
 				queue_push(&uart_receive_queue, data);
+
+				if(uart_rx_gap)
+					uart_rx_frame_length++;
+			}
 		}
 
+		if(uart_rx_gap && (status & UART_RXFIFO_TOUT_INT_ST))
+			uart_rx_frame_end();
+
 		system_os_post(background_task_id, 0, 0);
 	}
 
 	// receive transmit fifo "empty", room for new data in the fifo
 
-	if(read_peri_reg(UART_INT_ST(0)) & UART_TXFIFO_EMPTY_INT_ST)
+	if(status & UART_TXFIFO_EMPTY_INT_ST)
 	{
 		stat_uart_tx_interrupts++;
 
@@ -159,7 +259,7 @@ irom void uart_init(int baud, int data_bits, int stop_bits, uart_parity_t parity
 	// uart_start_transmit().
 
 	write_peri_reg(UART_CONF1(0),
-			(( 2 & UART_RX_TOUT_THRHD) << UART_RX_TOUT_THRHD_S) | UART_RX_TOUT_EN |
+			((uart_rx_tout_default & UART_RX_TOUT_THRHD) << UART_RX_TOUT_THRHD_S) | UART_RX_TOUT_EN |
 			((16 & UART_RXFIFO_FULL_THRHD) << UART_RXFIFO_FULL_THRHD_S) |
 			((64 & UART_TXFIFO_EMPTY_THRHD) << UART_TXFIFO_EMPTY_THRHD_S));
 
@@ -169,6 +269,47 @@ irom void uart_init(int baud, int data_bits, int stop_bits, uart_parity_t parity
 	ETS_UART_INTR_ENABLE();
 }
 
+irom void uart_set_rx_gap(int characters)
+{
+	// Use the receive fifo "timeout" to detect the inter-character
+	// idle gap of protocols like modbus rtu, the threshold is in
+	// characters' times, 0 = disable gap detection.
+
+	ETS_UART_INTR_DISABLE();
+
+	if((characters < 0) || (characters > UART_RX_TOUT_THRHD))
+		characters = 0;
+
+	uart_rx_gap = characters;
+	uart_rx_frame_length = 0;
+	uart_rx_frames_in = 0;
+	uart_rx_frames_out = 0;
+
+	clear_set_peri_reg_mask(UART_CONF1(0), UART_RX_TOUT_THRHD << UART_RX_TOUT_THRHD_S,
+			((characters ? characters : uart_rx_tout_default) & UART_RX_TOUT_THRHD) << UART_RX_TOUT_THRHD_S);
+
+	ETS_UART_INTR_ENABLE();
+}
+
+// drop everything received so far, including bytes still in the fifo and
+// frame boundaries not popped yet
+
+irom void uart_rx_flush(void)
+{
+	ETS_UART_INTR_DISABLE();
+
+	set_peri_reg_mask(UART_CONF0(0), UART_RXFIFO_RST);
+	clear_peri_reg_mask(UART_CONF0(0), UART_RXFIFO_RST);
+
+	queue_flush(&uart_receive_queue);
+
+	uart_rx_frame_length = 0;
+	uart_rx_frames_in = 0;
+	uart_rx_frames_out = 0;
+
+	ETS_UART_INTR_ENABLE();
+}
+
 iram void uart_start_transmit(char c)
 {
 	if(c)
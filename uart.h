@@ -15,6 +15,19 @@ typedef enum
 
 _Static_assert(sizeof(uart_parity_t) == 4, "sizeof(uart_parity_t) != 4");
 
+typedef enum
+{
+	uart_framing_none,
+	uart_framing_slip,
+	uart_framing_cobs,
+	uart_framing_delimiter,
+	uart_framing_gap,
+	uart_framing_modbus,
+	uart_framing_error
+} uart_framing_t;
+
+_Static_assert(sizeof(uart_framing_t) == 4, "sizeof(uart_framing_t) != 4");
+
 typedef struct
 {
 	uint32_t		baud_rate;
@@ -27,7 +40,12 @@ void			uart_parity_to_string(string_t *dst, uart_parity_t);
 char			uart_parity_to_char(uart_parity_t);
 uart_parity_t	uart_string_to_parity(const string_t *src);
 void			uart_parameters_to_string(string_t *dst, const uart_parameters_t *);
+uart_framing_t	uart_string_to_framing(const string_t *src);
+void			uart_framing_to_string(string_t *dst, uart_framing_t);
 void			uart_init(int baud, int data_bits, int stop_bits, uart_parity_t parity);
+void			uart_set_rx_gap(int characters);
+int				uart_rx_frame_pop(void);
+void			uart_rx_flush(void);
 void			uart_start_transmit(char);
 
 #endif
@@ -9,6 +9,9 @@
 #include "time.h"
 #include "i2c_sensor.h"
 #include "socket.h"
+#include "uart.h"
+#include "modbus.h"
+#include "notify.h"
 
 #if IMAGE_OTA == 1
 #include <rboot-api.h>
@@ -42,6 +45,21 @@ typedef enum
 
 _Static_assert(sizeof(telnet_strip_state_t) == 4, "sizeof(telnet_strip_state) != 4");
 
+typedef enum
+{
+	fs_data,
+	fs_escape,
+	fs_discard,
+} frame_state_t;
+
+enum
+{
+	slip_end = 0xc0,
+	slip_esc = 0xdb,
+	slip_esc_end = 0xdc,
+	slip_esc_esc = 0xdd,
+};
+
 os_event_t background_task_queue[background_task_queue_length];
 
 typedef struct
@@ -92,6 +110,24 @@ static socket_data_t socket_uart =
 };
 
 static bool_t uart_bridge_active = false;
+
+static struct
+{
+	uart_framing_t	mode;
+	frame_state_t	state;
+	uint8_t			delimiter;
+	uint8_t			cobs_code;
+	int				remaining;
+	int				gap;
+} uart_framing =
+{
+	.mode = uart_framing_none,
+	.state = fs_data,
+	.delimiter = '\n',
+	.cobs_code = 0,
+	.remaining = 0,
+	.gap = 0,
+};
 static reset_state_t reset_state = reset_state_inactive;
 
 static struct
@@ -135,12 +171,197 @@ iram void user_rf_pre_init(void)
 
 static void user_init2(void);
 
+iram static void uart_frame_append(uint8_t byte)
+{
+	if(uart_framing.state == fs_discard)
+		return;
+
+	if(!string_space(&socket_uart.send_buffer))
+	{
+		stat_uart_frames_oversize++;
+		string_clear(&socket_uart.send_buffer);
+		uart_framing.state = fs_discard;
+		return;
+	}
+
+	string_append_char(&socket_uart.send_buffer, byte);
+}
+
+iram static void uart_frame_error(void)
+{
+	if(uart_framing.state != fs_discard)
+	{
+		stat_uart_frame_errors++;
+		string_clear(&socket_uart.send_buffer);
+		uart_framing.state = fs_discard;
+	}
+}
+
+iram static bool_t uart_frame_end(void)
+{
+	bool_t complete;
+
+	complete = (uart_framing.state != fs_discard) && !string_empty(&socket_uart.send_buffer);
+
+	uart_framing.state = fs_data;
+	uart_framing.cobs_code = 0;
+	uart_framing.remaining = 0;
+
+	if(complete)
+		stat_uart_frames++;
+
+	return(complete);
+}
+
+// drop the remainder of a frame that's partially collected in the send buffer
+
+iram static void uart_frame_abort(void)
+{
+	if((socket_uart.state == socket_state_idle) && !string_empty(&socket_uart.send_buffer))
+		uart_framing.state = fs_discard;
+}
+
+// collect data from the uart until a complete frame is in the send buffer,
+// a partial frame is kept in the send buffer until the next call
+
+iram static bool_t uart_frame_receive(void)
+{
+	uint8_t byte;
+	int length;
+
+	while(!queue_empty(&uart_receive_queue))
+	{
+		if((uart_framing.mode == uart_framing_gap) || (uart_framing.mode == uart_framing_modbus))
+		{
+			if(uart_framing.remaining == 0)
+			{
+				if((length = uart_rx_frame_pop()) < 0)
+					return(false);
+
+				uart_framing.remaining = length;
+			}
+
+			uart_frame_append(queue_pop(&uart_receive_queue));
+
+			if((--uart_framing.remaining == 0) && uart_frame_end())
+				return(true);
+
+			continue;
+		}
+
+		byte = queue_pop(&uart_receive_queue);
+
+		switch(uart_framing.mode)
+		{
+			case(uart_framing_slip):
+			{
+				if(uart_framing.state == fs_escape)
+				{
+					uart_framing.state = fs_data;
+
+					if(byte == slip_esc_end)
+						uart_frame_append(slip_end);
+					else if(byte == slip_esc_esc)
+						uart_frame_append(slip_esc);
+					else
+						uart_frame_error();
+				}
+				else
+				{
+					if(byte == slip_end)
+					{
+						if(uart_frame_end())
+							return(true);
+					}
+					else if(byte == slip_esc)
+					{
+						if(uart_framing.state != fs_discard)
+							uart_framing.state = fs_escape;
+					}
+					else
+						uart_frame_append(byte);
+				}
+
+				break;
+			}
+
+			case(uart_framing_cobs):
+			{
+				if(byte == 0x00)
+				{
+					if(uart_framing.remaining != 0)
+						uart_frame_error();
+
+					if(uart_frame_end())
+						return(true);
+				}
+				else if(uart_framing.remaining == 0)
+				{
+					if((uart_framing.cobs_code != 0) && (uart_framing.cobs_code != 0xff))
+						uart_frame_append(0x00);
+
+					uart_framing.cobs_code = byte;
+					uart_framing.remaining = byte - 1;
+				}
+				else
+				{
+					uart_frame_append(byte);
+					uart_framing.remaining--;
+				}
+
+				break;
+			}
+
+			case(uart_framing_delimiter):
+			{
+				if(byte == uart_framing.delimiter)
+				{
+					if(uart_frame_end())
+						return(true);
+				}
+				else
+					uart_frame_append(byte);
+
+				break;
+			}
+
+			default:
+			{
+				break;
+			}
+		}
+	}
+
+	return(false);
+}
+
 iram static bool_t background_task_bridge_uart(void)
 {
 	if(socket_uart.state == socket_state_idle)
 	{
-		while(!queue_empty(&uart_receive_queue) && string_space(&socket_uart.send_buffer))
-			string_append_char(&socket_uart.send_buffer, queue_pop(&uart_receive_queue));
+		if(uart_framing.mode == uart_framing_none)
+		{
+			while(!queue_empty(&uart_receive_queue) && string_space(&socket_uart.send_buffer))
+				string_append_char(&socket_uart.send_buffer, queue_pop(&uart_receive_queue));
+		}
+		else if(uart_framing.mode == uart_framing_modbus)
+		{
+			// a complete rtu response or a timeout yields a reply to the client
+
+			if(uart_frame_receive())
+			{
+				if(!modbus_response(&socket_uart.send_buffer, &socket_uart.socket))
+					string_clear(&socket_uart.send_buffer);
+			}
+			else
+				if(!modbus_timeout(&socket_uart.send_buffer, &socket_uart.socket))
+					string_clear(&socket_uart.send_buffer);
+
+			modbus_transmit();
+		}
+		else
+			if(!uart_frame_receive())
+				return(false);
 
 		if(!string_empty(&socket_uart.send_buffer))
 		{
@@ -342,7 +563,12 @@ iram static void fast_timer_callback(void *arg)
 
 	// timer runs every 10 ms = 100 Hz
 
+	// retire the i2c transactions done since the previous tick first, so
+	// io_periodic sees the results of the reads it queued then
+
+	i2c_periodic();
 	io_periodic();
+	notify_periodic();
 }
 
 iram static void slow_timer_callback(void *arg)
@@ -489,6 +715,100 @@ iram static void callback_received_cmd(socket_t *socket, const string_t *buffer,
 	system_os_post(background_task_id, 0, 0);
 }
 
+iram static void uart_send_byte(uint8_t byte)
+{
+	if(queue_full(&uart_send_queue))
+		stat_uart_receive_buffer_overflow++;
+	else
+		queue_push(&uart_send_queue, byte);
+}
+
+iram static void uart_frame_send(const string_t *buffer)
+{
+	int current, length, run, ix;
+	uint8_t byte;
+
+	length = string_length(buffer);
+
+	switch(uart_framing.mode)
+	{
+		case(uart_framing_slip):
+		{
+			uart_send_byte(slip_end);
+
+			for(current = 0; current < length; current++)
+			{
+				byte = string_at(buffer, current);
+
+				if(byte == slip_end)
+				{
+					uart_send_byte(slip_esc);
+					uart_send_byte(slip_esc_end);
+				}
+				else if(byte == slip_esc)
+				{
+					uart_send_byte(slip_esc);
+					uart_send_byte(slip_esc_esc);
+				}
+				else
+					uart_send_byte(byte);
+			}
+
+			uart_send_byte(slip_end);
+
+			break;
+		}
+
+		case(uart_framing_cobs):
+		{
+			for(current = 0;;)
+			{
+				for(run = 0; (run < 254) && ((current + run) < length) && (string_at(buffer, current + run) != 0x00); run++)
+					(void)0;
+
+				uart_send_byte(run + 1);
+
+				for(ix = 0; ix < run; ix++)
+					uart_send_byte(string_at(buffer, current + ix));
+
+				current += run;
+
+				if(current >= length)
+					break;
+
+				// a full block (code 0xff) isn't followed by an implicit zero
+
+				if(run < 254)
+					current++;
+			}
+
+			uart_send_byte(0x00);
+
+			break;
+		}
+
+		case(uart_framing_delimiter):
+		{
+			for(current = 0; current < length; current++)
+				uart_send_byte(string_at(buffer, current));
+
+			uart_send_byte(uart_framing.delimiter);
+
+			break;
+		}
+
+		default:
+		{
+			for(current = 0; current < length; current++)
+				uart_send_byte(string_at(buffer, current));
+
+			break;
+		}
+	}
+
+	uart_start_transmit(!queue_empty(&uart_send_queue));
+}
+
 iram static void callback_received_uart(socket_t *socket, const string_t *buffer, void *userdata)
 {
 	int current, length;
@@ -496,6 +816,19 @@ iram static void callback_received_uart(socket_t *socket, const string_t *buffer
 	bool_t strip_telnet;
 	telnet_strip_state_t telnet_strip_state;
 
+	if(uart_framing.mode == uart_framing_modbus)
+	{
+		modbus_request(socket, buffer);
+		modbus_transmit();
+		return;
+	}
+
+	if(uart_framing.mode != uart_framing_none)
+	{
+		uart_frame_send(buffer);
+		return;
+	}
+
 	length = string_length(buffer);
 
 	strip_telnet = config_flags_get().flag.strip_telnet;
@@ -512,12 +845,7 @@ iram static void callback_received_uart(socket_t *socket, const string_t *buffer
 				if(strip_telnet && (byte == 0xff))
 					telnet_strip_state = ts_dodont;
 				else
-				{
-					if(queue_full(&uart_send_queue))
-						stat_uart_receive_buffer_overflow++;
-					else
-						queue_push(&uart_send_queue, byte);
-				}
+					uart_send_byte(byte);
 
 				break;
 			}
@@ -573,6 +901,7 @@ irom static void callback_error_cmd(socket_t *socket, int error, void *userdata)
 
 irom static void callback_error_uart(socket_t *socket, int error, void *userdata)
 {
+	uart_frame_abort();
 	string_clear(&socket_uart.send_buffer);
 	socket_uart.state = socket_state_idle;
 }
@@ -589,6 +918,10 @@ irom static void callback_disconnect_cmd(socket_t *socket, void *userdata)
 
 irom static void callback_disconnect_uart(socket_t *socket, void *userdata)
 {
+	if(uart_framing.mode == uart_framing_modbus)
+		modbus_disconnect();
+
+	uart_frame_abort();
 	string_clear(&socket_uart.send_buffer);
 	socket_uart.state = socket_state_idle;
 }
@@ -602,20 +935,38 @@ irom static void callback_accept_cmd(socket_t *socket, void *userdata)
 
 irom static void callback_accept_uart(socket_t *socket, void *userdata)
 {
+	// in modbus mode the uart is shared by all clients, don't disrupt
+	// running transactions
+
+	if(uart_framing.mode == uart_framing_modbus)
+	{
+		modbus_disconnect();
+		return;
+	}
+
 	queue_flush(&uart_send_queue);
 	queue_flush(&uart_receive_queue);
 
+	if(uart_framing.mode == uart_framing_gap)
+		uart_set_rx_gap(uart_framing.gap);
+
 	string_clear(&socket_uart.send_buffer);
 	socket_uart.state = socket_state_idle;
+
+	uart_frame_end();
 }
 
 irom static void user_init2(void)
 {
 	int uart_port, uart_timeout;
+	int uart_framing_int, uart_delimiter, uart_gap;
 	int cmd_port, cmd_timeout;
 
 	string_init(varname_bridge_port, "bridge.port");
 	string_init(varname_bridge_timeout, "bridge.timeout");
+	string_init(varname_bridge_framing, "bridge.framing");
+	string_init(varname_bridge_delimiter, "bridge.delimiter");
+	string_init(varname_bridge_gap, "bridge.gap");
 	string_init(varname_cmd_port, "cmd.port");
 	string_init(varname_cmd_timeout, "cmd.timeout");
 
@@ -625,6 +976,15 @@ irom static void user_init2(void)
 	if(!config_get_int(&varname_bridge_timeout, -1, -1, &uart_timeout))
 		uart_timeout = 90;
 
+	if(!config_get_int(&varname_bridge_framing, -1, -1, &uart_framing_int))
+		uart_framing_int = uart_framing_none;
+
+	if(!config_get_int(&varname_bridge_delimiter, -1, -1, &uart_delimiter))
+		uart_delimiter = '\n';
+
+	if(!config_get_int(&varname_bridge_gap, -1, -1, &uart_gap))
+		uart_gap = 4;
+
 	if(!config_get_int(&varname_cmd_port, -1, -1, &cmd_port))
 		cmd_port = 24;
 
@@ -645,11 +1005,25 @@ irom static void user_init2(void)
 	socket_create(true, true, &socket_cmd.socket, cmd_port, cmd_timeout,
 			callback_received_cmd, callback_sent_cmd, callback_error_cmd, callback_disconnect_cmd, callback_accept_cmd, (void *)&socket_cmd);
 
+	notify_init();
+
 	if(uart_port > 0)
 	{
 		socket_create(true, true, &socket_uart.socket, uart_port, uart_timeout,
 				callback_received_uart, callback_sent_uart, callback_error_uart, callback_disconnect_uart, callback_accept_uart, (void *)&socket_uart);
 
+		if((uart_framing_int > uart_framing_none) && (uart_framing_int < uart_framing_error))
+		{
+			uart_framing.mode = (uart_framing_t)uart_framing_int;
+			uart_framing.delimiter = (uint8_t)uart_delimiter;
+
+			if((uart_framing.mode == uart_framing_gap) || (uart_framing.mode == uart_framing_modbus))
+			{
+				uart_framing.gap = uart_gap;
+				uart_set_rx_gap(uart_gap);
+			}
+		}
+
 		uart_bridge_active = true;
 	}
 
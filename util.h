@@ -138,6 +138,15 @@ void logchar(char c);
 void msleep(int);
 ip_addr_t ip_addr(const char *);
 
+always_inline static uint32_t read_ccount(void)
+{
+	uint32_t ccount;
+
+	asm volatile("rsr %0, ccount" : "=r"(ccount));
+
+	return(ccount);
+}
+
 // string functions
 
 typedef struct